@@ -781,7 +781,14 @@ void TryRunTics (void)
 	    return;
 	}
 
-        I_Sleep(1);
+        if (net_client_connected)
+        {
+            I_Sleep(1);
+        }
+        else
+        {
+            I_WaitTic((entertic + 1) * ticdup);
+        }
     }
 
     // run the count * ticdup dics
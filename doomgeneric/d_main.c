@@ -28,6 +28,7 @@
 #include "config.h"
 #include "deh_main.h"
 #include "doomdef.h"
+#include "doomgeneric.h"
 #include "doomstat.h"
 
 #include "dstrings.h"
@@ -215,12 +216,12 @@ void D_Display (void)
 			break;
 		if (automapactive)
 			AM_Drawer ();
-		if (wipe || (viewheight != 200 && fullscreen) )
+		if (wipe || (viewheight != SCREENHEIGHT && fullscreen) )
 			redrawsbar = true;
 		if (inhelpscreensstate && !inhelpscreens)
 			redrawsbar = true;              // just put away the help screen
-		ST_Drawer (viewheight == 200, redrawsbar );
-		fullscreen = viewheight == 200;
+		ST_Drawer (viewheight == SCREENHEIGHT, redrawsbar );
+		fullscreen = viewheight == SCREENHEIGHT;
 		break;
 
       case GS_INTERMISSION:
@@ -258,7 +259,7 @@ void D_Display (void)
     }
 
     // see if the border needs to be updated to the screen
-    if (gamestate == GS_LEVEL && !automapactive && scaledviewwidth != 320)
+    if (gamestate == GS_LEVEL && !automapactive && scaledviewwidth != SCREENWIDTH)
     {
 		if (menuactive || menuactivestate || !viewactivestate)
 			borderdrawcount = 3;
@@ -287,8 +288,9 @@ void D_Display (void)
 		if (automapactive)
 			y = 4;
 		else
-			y = viewwindowy+4;
-		V_DrawPatchDirect(viewwindowx + (scaledviewwidth - 68) / 2, y,
+			y = FROMSCREENY(viewwindowy)+4;
+		V_DrawPatchDirect(FROMSCREENX(viewwindowx)
+		                + (FROMSCREENX(scaledviewwidth) - 68) / 2, y,
 							  W_CacheLumpName (DEH_String("M_PAUSE"), PU_CACHE));
     }
 
@@ -316,7 +318,7 @@ void D_Display (void)
 	{
 	    nowtime = I_GetTime ();
 	    tics = nowtime - wipestart;
-            I_Sleep(1);
+            I_WaitTic(wipestart + 1);
 	} while (tics <= 0);
         
 	wipestart = nowtime;
@@ -415,6 +417,11 @@ void doomgeneric_Tick()
     if (screenvisible)
     {
         D_Display ();
+
+        if (DG_LatencyHook != NULL)
+        {
+            DG_LatencyHook(DG_LATENCY_DISPLAY, gametic);
+        }
     }
 }
 
@@ -6,6 +6,8 @@
 
 pixel_t* DG_ScreenBuffer = NULL;
 
+void (*DG_LatencyHook)(int stage, int tic) = NULL;
+
 void M_FindResponseFile(void);
 void D_DoomMain (void);
 
@@ -18,7 +20,7 @@ void doomgeneric_Create(int argc, char **argv)
 
 	M_FindResponseFile();
 
-	DG_ScreenBuffer = malloc(DOOMGENERIC_RESX * DOOMGENERIC_RESY * 4);
+	DG_ScreenBuffer = malloc(DOOMGENERIC_RESX * DOOMGENERIC_RESY * sizeof(pixel_t));
 
 	DG_Init();
 
@@ -42,6 +42,17 @@ uint32_t DG_GetTicksMs();
 int DG_GetKey(int* pressed, unsigned char* key);
 void DG_SetWindowTitle(const char * title);
 
+// Optional. Called by the engine when it builds the ticcmd for a tic
+// and when D_Display has finished, so a platform can time how long
+// input takes to show up on screen. NULL unless a platform sets it.
+enum
+{
+    DG_LATENCY_TICCMD,      // tic is the one the ticcmd was built for
+    DG_LATENCY_DISPLAY,     // tic is gametic
+};
+
+extern void (*DG_LatencyHook)(int stage, int tic);
+
 #ifdef __cplusplus
 }
 #endif
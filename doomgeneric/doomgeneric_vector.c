@@ -2,6 +2,8 @@
 // Created by ekeleze on 1/13/26.
 //
 
+#define _GNU_SOURCE
+
 #include "doomgeneric.h"
 #include <stdio.h>
 #include <stdint.h>
@@ -10,23 +12,37 @@
 #include <sys/ioctl.h>
 #include <linux/spi/spidev.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <sys/time.h>
 #include <termios.h>
 #include <signal.h>
+#include <pthread.h>
 
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <stdlib.h>
-#include <stdbool.h>
 
+#include "d_event.h"
 #include "doomkeys.h"
 #include "doomgeneric.h"
+#include "doomtype.h"
+#include "i_system.h"
+#include "i_timer.h"
+#include "i_video.h"
+#include "m_argv.h"
+#include "vector_export.h"
+#include "vector_input.h"
+#include "vector_stream.h"
+
+#ifdef LCD_SIM
+#include "lcd_sim.h"
+#endif
 
-#define SERVER_PORT 666
+#define SERVER_PORT VI_PORT
 
 #define GPIO_LCD_WRX 110
 #define GPIO_LCD_RESET_MIDAS 96
@@ -35,17 +51,99 @@
 #define XSHIFT 0x0
 #define YSHIFT 0x18
 
-#define DOOMGENERIC_RESX 320
-#define DOOMGENERIC_RESY 200
-
 static int udp_sock = -1;
 
+static void input_print_stats();
+static void probe_presented(unsigned int frame);
+
 static int lcd_fd = -1;
 static int MAX_TRANSFER = 0x1000;
 
-static int framebuffer_size = 184 * 96;
+static boolean v1 = true;
+
+// Panel geometry and the part of it the game view is scaled into
+
+#define LCD_MAX_WIDTH 184
+#define LCD_MAX_HEIGHT 96
+
+static int lcd_width = 184;
+static int lcd_height = 96;
+static int view_x = 15;
+static int view_width = 154;
+
+// Palette index -> panel pixel, already in the byte order the panel
+// expects. Rebuilt whenever I_SetPalette flags a palette change.
+
+static uint16_t lcd_palette[256];
+
+// Source column / row offset into the 320x200 indexed frame for each
+// panel pixel, so the per-frame scaler does no arithmetic.
+
+static int src_col[LCD_MAX_WIDTH];
+static int src_row[LCD_MAX_HEIGHT];
+
+// Display worker. DG_DrawFrame scales into lcd_back and hands it over,
+// the worker swaps it with lcd_front and pushes that to the panel while
+// the game keeps running. Only the worker touches lcd_fd once started.
+// If the panel is still busy when the next frame is ready, the unsent
+// one is overwritten: the latest frame wins.
+
+static uint16_t lcd_frames[2][LCD_MAX_WIDTH * LCD_MAX_HEIGHT];
+static uint16_t* lcd_back = lcd_frames[0];
+static uint16_t* lcd_front = lcd_frames[1];
+static boolean lcd_pending = false;
+
+static pthread_t lcd_thread;
+static pthread_mutex_t lcd_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lcd_cond = PTHREAD_COND_INITIALIZER;
+
+typedef struct {
+    unsigned int submitted;
+    unsigned int sent;
+    unsigned int dropped;
+    unsigned int partial;
+    unsigned int unchanged;
+} lcd_stats_t;
+
+static lcd_stats_t lcd_stats;
+
+// Panel bring-up (board probe, reset and init sequence) runs on
+// lcd_init_thread while the engine loads, and is joined by the first
+// DG_DrawFrame. Times are in ms since DG_Init.
+
+static pthread_t lcd_init_thread;
+static boolean lcd_ready = false;
+
+typedef struct {
+    uint32_t start;
+    uint32_t probe;
+    uint32_t panel;
+    uint32_t engine;
+    uint32_t first_frame;
+} lcd_startup_t;
+
+static lcd_startup_t lcd_startup;
+
+// Dirty-region tracking. The worker diffs each frame against lcd_shadow,
+// the panel contents as last written, and only rewrites the changed row
+// bands through a CASET/RASET window. When the changed area exceeds
+// lcd_full_percent of the panel, the whole frame is written instead.
 
-static bool v1 = true;
+#define LCD_DIRTY_GAP 4
+
+typedef struct {
+    int x0, y0;
+    int x1, y1;
+} lcd_rect_t;
+
+static uint16_t lcd_shadow[LCD_MAX_WIDTH * LCD_MAX_HEIGHT];
+static uint16_t lcd_packed[LCD_MAX_WIDTH * LCD_MAX_HEIGHT];
+static boolean lcd_shadow_valid = false;
+static int lcd_full_percent = 50;
+
+// Panel RAM address of pixel (0, 0)
+static int lcd_col_offset = 0;
+static int lcd_row_offset = 0;
 
 static void gpio_export(int pin) {
     int fd = open("/sys/class/gpio/export", O_WRONLY);
@@ -65,31 +163,144 @@ static void gpio_set_direction(int pin, const char* dir) {
     close(fd);
 }
 
-static void gpio_write(int pin, int value) {
+// The sysfs value files are opened once and kept; a D/C toggle is then a
+// single pwrite, and skipped entirely when the line is already right.
+
+static int gpio_open_value(int pin) {
     char path[64];
     snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d/value", pin);
-    int fd = open(path, O_WRONLY);
+    return open(path, O_WRONLY);
+}
+
+static void gpio_set(int fd, int value) {
     if (fd < 0) return;
-    write(fd, value ? "1" : "0", 1);
-    close(fd);
+    pwrite(fd, value ? "1" : "0", 1, 0);
 }
 
+static int lcd_dc_fd = -1;
+static int lcd_dc_level = -1;
+static int lcd_reset_fd = -1;
+
+// Largest single spi_ioc_transfer segment. spidev also caps a whole
+// SPI_IOC_MESSAGE at its bufsiz (MAX_TRANSFER), so a payload goes out in
+// as few messages as that allows, each carrying several segments when
+// bufsiz has been raised above the segment size.
+
+#define LCD_SEGMENT_SIZE 0x1000
+#define LCD_MAX_SEGMENTS 16
+
 static void lcd_spi_transfer(int is_cmd, int bytes, const void* data) {
+    struct spi_ioc_transfer xfer[LCD_MAX_SEGMENTS];
     const uint8_t* tx_buf = data;
 
     // DC pin: LOW=command, HIGH=data
-    gpio_write(GPIO_LCD_WRX, is_cmd ? 0 : 1);
+    if (lcd_dc_level != !is_cmd) {
+        gpio_set(lcd_dc_fd, !is_cmd);
+        lcd_dc_level = !is_cmd;
+    }
 
     while (bytes > 0) {
-        size_t count = bytes > MAX_TRANSFER ? MAX_TRANSFER : bytes;
-        write(lcd_fd, tx_buf, count);
-        bytes -= count;
-        tx_buf += count;
+        int segments = 0;
+        int total = 0;
+
+        memset(xfer, 0, sizeof(xfer));
+
+        while (bytes > 0 && segments < LCD_MAX_SEGMENTS) {
+            int count = bytes > LCD_SEGMENT_SIZE ? LCD_SEGMENT_SIZE : bytes;
+
+            if (total + count > MAX_TRANSFER) {
+                count = MAX_TRANSFER - total;
+                if (count <= 0) break;
+            }
+
+            xfer[segments].tx_buf = (uintptr_t) tx_buf;
+            xfer[segments].len = count;
+            segments++;
+
+            total += count;
+            bytes -= count;
+            tx_buf += count;
+        }
+
+        if (ioctl(lcd_fd, SPI_IOC_MESSAGE(segments), xfer) < 0) {
+            fprintf(stderr, "SPI transfer failed: %d\n", errno);
+            return;
+        }
     }
 }
 
+typedef struct {
+    uint8_t cmd;
+    uint8_t len;
+    uint8_t data[16];
+    uint32_t delay;
+} lcd_init_cmd_t;
+
+static void lcd_command(uint8_t cmd, int len, const void* data) {
+    lcd_spi_transfer(1, 1, &cmd);
+    if (len) {
+        lcd_spi_transfer(0, len, data);
+    }
+}
+
+static void lcd_open(int reset_pin) {
+    gpio_export(GPIO_LCD_WRX);
+    gpio_export(reset_pin);
+    gpio_set_direction(GPIO_LCD_WRX, "out");
+    gpio_set_direction(reset_pin, "out");
+
+    lcd_dc_fd = gpio_open_value(GPIO_LCD_WRX);
+    lcd_reset_fd = gpio_open_value(reset_pin);
+    if (lcd_dc_fd < 0 || lcd_reset_fd < 0) {
+        fprintf(stderr, "Can't open LCD GPIOs: %d\n", errno);
+        exit(1);
+    }
+
+    gpio_set(lcd_reset_fd, 0);
+    usleep(50000);
+    gpio_set(lcd_reset_fd, 1);
+    usleep(120000);
+
+    lcd_fd = open("/dev/spidev1.0", O_RDWR);
+    if (lcd_fd < 0) {
+        fprintf(stderr, "Can't open SPI: %d\n", errno);
+        exit(1);
+    }
+
+    uint8_t mode = 0;
+    ioctl(lcd_fd, SPI_IOC_RD_MODE, &mode);
+
+    int bufsiz_fd = open("/sys/module/spidev/parameters/bufsiz", O_RDONLY);
+    if (bufsiz_fd >= 0) {
+        char buf[32] = {0};
+        read(bufsiz_fd, buf, sizeof(buf));
+        if (atoi(buf) > 0) {
+            MAX_TRANSFER = atoi(buf);
+        }
+        close(bufsiz_fd);
+        printf("SPI max transfer: %d bytes\n", MAX_TRANSFER);
+    }
+}
 
-bool IsVector1() {
+static void lcd_run_init(const lcd_init_cmd_t* init) {
+    for (int i = 0; init[i].cmd; i++) {
+        lcd_command(init[i].cmd, init[i].len, init[i].data);
+        if (init[i].delay) {
+            usleep(init[i].delay * 1000);
+        }
+    }
+}
+
+// Board probe. emr-cat reads the hardware revision out of the EMR
+// partition, which costs a shell and a fork, so a good answer is kept in
+// LCD_MODEL_CACHE (tmpfs, so it is dropped on reboot). -lcdmodel skips
+// the probe altogether.
+
+#define LCD_MODEL_CACHE "/run/doomgeneric-vector-lcd"
+
+static const char* lcd_model = NULL;
+
+static boolean lcd_read_emr(boolean* is_v1) {
     FILE *fp;
     char buffer[128];
     int result;
@@ -97,65 +308,72 @@ bool IsVector1() {
     fp = popen("emr-cat v", "r");
     if (fp == NULL) {
         perror("popen failed");
-        return true;
+        return false;
     }
 
     if (fgets(buffer, sizeof(buffer), fp) != NULL) {
         if (sscanf(buffer, "%x", &result) == 1) {
             pclose(fp);
-            if (result == 0x6) return true;
-            else if (result == 0x20) return false;
-            else {
-                fprintf(stderr, "Unexpected output: %s\n", buffer);
+            if (result == 0x6) {
+                *is_v1 = true;
                 return true;
+            } else if (result == 0x20) {
+                *is_v1 = false;
+                return true;
+            } else {
+                fprintf(stderr, "Unexpected output: %s\n", buffer);
+                return false;
             }
         }
     }
 
     pclose(fp);
     fprintf(stderr, "Failed to read output.\n");
-    return true;
+    return false;
 }
 
-void SANTEK_Init() {
-	printf("Initializing SANTEK LCD (184x96)...\n");
+boolean IsVector1() {
+    char buffer[16] = {0};
+    boolean is_v1;
+    FILE* fp;
 
-	framebuffer_size = 184 * 96;
+    if (lcd_model != NULL) {
+        return strcasecmp(lcd_model, "midas") != 0;
+    }
 
-	gpio_export(GPIO_LCD_WRX);
-	gpio_export(GPIO_LCD_RESET_SANTEK);
-	gpio_set_direction(GPIO_LCD_WRX, "out");
-	gpio_set_direction(GPIO_LCD_RESET_SANTEK, "out");
+    fp = fopen(LCD_MODEL_CACHE, "r");
+    if (fp != NULL) {
+        boolean ok = fgets(buffer, sizeof(buffer), fp) != NULL;
+        fclose(fp);
+        if (ok) {
+            return strncmp(buffer, "midas", 5) != 0;
+        }
+    }
 
-	gpio_write(GPIO_LCD_RESET_SANTEK, 0);
-    usleep(50000);
-    gpio_write(GPIO_LCD_RESET_SANTEK, 1);
-    usleep(120000);
+    if (!lcd_read_emr(&is_v1)) {
+        return true;
+    }
 
-	lcd_fd = open("/dev/spidev1.0", O_RDWR);
-    if (lcd_fd < 0) {
-        fprintf(stderr, "Can't open SPI: %d\n", errno);
-        exit(1);
+    fp = fopen(LCD_MODEL_CACHE, "w");
+    if (fp != NULL) {
+        fprintf(fp, "%s\n", is_v1 ? "santek" : "midas");
+        fclose(fp);
     }
 
-	uint8_t mode = 0;
-    ioctl(lcd_fd, SPI_IOC_RD_MODE, &mode);
+    return is_v1;
+}
 
-	int bufsiz_fd = open("/sys/module/spidev/parameters/bufsiz", O_RDONLY);
-    if (bufsiz_fd >= 0) {
-        char buf[32] = {0};
-        read(bufsiz_fd, buf, sizeof(buf));
-        MAX_TRANSFER = atoi(buf);
-        close(bufsiz_fd);
-        printf("SPI max transfer: %d bytes\n", MAX_TRANSFER);
-    }
+void SANTEK_Init() {
+	printf("Initializing SANTEK LCD (184x96)...\n");
+
+	lcd_width = 184;
+	lcd_height = 96;
+	lcd_col_offset = RSHIFT;
+	lcd_row_offset = 0;
+
+	lcd_open(GPIO_LCD_RESET_SANTEK);
 
-	struct {
-        uint8_t cmd;
-        uint8_t len;
-        uint8_t data[16];
-        uint32_t delay;
-    } init[] = {
+	static const lcd_init_cmd_t init[] = {
         { 0x10, 1, { 0x00 }, 120}, // Sleep in
   		{ 0x2A, 4, { 0x00, RSHIFT, (184 + RSHIFT - 1) >> 8, (184 + RSHIFT - 1) & 0xFF } }, // Column address set
   		{ 0x2B, 4, { 0x00, 0x00, (96 -1) >> 8, (96 -1) & 0xFF } }, // Row address set
@@ -180,15 +398,7 @@ void SANTEK_Init() {
   		{ 0 }
     };
 
-	for (int i = 0; init[i].cmd; i++) {
-        lcd_spi_transfer(1, 1, &init[i].cmd);
-        if (init[i].len) {
-            lcd_spi_transfer(0, init[i].len, init[i].data);
-        }
-        if (init[i].delay) {
-            usleep(init[i].delay * 1000);
-        }
-    }
+	lcd_run_init(init);
 
 	printf("SANTEK LCD initialized!\n");
 }
@@ -196,42 +406,14 @@ void SANTEK_Init() {
 void MIDAS_Init() {
 	printf("Initializing MIDAS LCD (160x80)...\n");
 
-	framebuffer_size = 160 * 80;
-
-    gpio_export(GPIO_LCD_WRX);
-    gpio_export(GPIO_LCD_RESET_MIDAS);
-    gpio_set_direction(GPIO_LCD_WRX, "out");
-    gpio_set_direction(GPIO_LCD_RESET_MIDAS, "out");
-
-    gpio_write(GPIO_LCD_RESET_MIDAS, 0);
-    usleep(50000);
-    gpio_write(GPIO_LCD_RESET_MIDAS, 1);
-    usleep(120000);
-
-    lcd_fd = open("/dev/spidev1.0", O_RDWR);
-    if (lcd_fd < 0) {
-        fprintf(stderr, "Can't open SPI: %d\n", errno);
-        exit(1);
-    }
-
-    uint8_t mode = 0;
-    ioctl(lcd_fd, SPI_IOC_RD_MODE, &mode);
+	lcd_width = 160;
+	lcd_height = 80;
+	lcd_col_offset = XSHIFT;
+	lcd_row_offset = YSHIFT;
 
-    int bufsiz_fd = open("/sys/module/spidev/parameters/bufsiz", O_RDONLY);
-    if (bufsiz_fd >= 0) {
-        char buf[32] = {0};
-        read(bufsiz_fd, buf, sizeof(buf));
-        MAX_TRANSFER = atoi(buf);
-        close(bufsiz_fd);
-        printf("SPI max transfer: %d bytes\n", MAX_TRANSFER);
-    }
+    lcd_open(GPIO_LCD_RESET_MIDAS);
 
-    struct {
-        uint8_t cmd;
-        uint8_t len;
-        uint8_t data[16];
-        uint32_t delay;
-    } init[] = {
+    static const lcd_init_cmd_t init[] = {
         {0x01, 0, {0}, 150},        // Software reset
         {0x11, 0, {0}, 500},        // Sleep out
         {0x20, 0, {0}, 0},          // Display inversion off
@@ -256,27 +438,268 @@ void MIDAS_Init() {
         {0, 0, {0}, 0}
     };
 
-    for (int i = 0; init[i].cmd; i++) {
-        lcd_spi_transfer(1, 1, &init[i].cmd);
-        if (init[i].len) {
-            lcd_spi_transfer(0, init[i].len, init[i].data);
+    lcd_run_init(init);
+
+    printf("MIDAS LCD initialized!\n");
+}
+
+static void lcd_init_scaler() {
+    // SANTEK keeps the old 25/12 step and letterboxes it, MIDAS fills the panel.
+    // The steps are given for a 320x200 frame and scaled to the buffer size,
+    // so a LOWRES build samples the same picture from a smaller frame.
+    view_x = v1 ? 15 : 0;
+    view_width = v1 ? 154 : 160;
+
+    for (int x = 0; x < view_width; x++) {
+        src_col[x] = v1 ? (x * 25 * DOOMGENERIC_RESX) / (12 * 320)
+                        : (x * 2 * DOOMGENERIC_RESX) / 320;
+    }
+
+    for (int y = 0; y < lcd_height; y++) {
+        src_row[y] = (v1 ? (y * 25 * DOOMGENERIC_RESY) / (12 * 200)
+                         : (y * 5 * DOOMGENERIC_RESY) / (2 * 200)) * DOOMGENERIC_RESX;
+    }
+
+    memset(lcd_frames, 0, sizeof(lcd_frames));
+}
+
+static void lcd_update_palette() {
+    for (int i = 0; i < 256; i++) {
+        uint16_t c = ((colors[i].r & 0xF8) << 8) | ((colors[i].g & 0xFC) << 3) | (colors[i].b >> 3);
+
+        // SANTEK is set to LSB first through RAM control, MIDAS wants MSB first
+        lcd_palette[i] = v1 ? c : ((c >> 8) | (c << 8));
+    }
+
+    palette_changed = false;
+}
+
+static void lcd_write_rect(const uint16_t* frame, const lcd_rect_t* r) {
+    static const uint8_t WRITE_RAM = 0x2C;
+    int width = r->x1 - r->x0 + 1;
+    int height = r->y1 - r->y0 + 1;
+    int x0 = r->x0 + lcd_col_offset;
+    int x1 = r->x1 + lcd_col_offset;
+    int y0 = r->y0 + lcd_row_offset;
+    int y1 = r->y1 + lcd_row_offset;
+    const uint16_t* data;
+
+    uint8_t caset[4] = { x0 >> 8, x0 & 0xFF, x1 >> 8, x1 & 0xFF };
+    uint8_t raset[4] = { y0 >> 8, y0 & 0xFF, y1 >> 8, y1 & 0xFF };
+
+    // Full-width bands are already contiguous in the frame
+    if (width == lcd_width) {
+        data = frame + r->y0 * lcd_width;
+    } else {
+        for (int y = 0; y < height; y++) {
+            memcpy(lcd_packed + y * width, frame + (r->y0 + y) * lcd_width + r->x0,
+                   width * sizeof(uint16_t));
         }
-        if (init[i].delay) {
-            usleep(init[i].delay * 1000);
+        data = lcd_packed;
+    }
+
+    lcd_command(0x2A, 4, caset);
+    lcd_command(0x2B, 4, raset);
+    lcd_command(WRITE_RAM, width * height * sizeof(uint16_t), data);
+
+    for (int y = r->y0; y <= r->y1; y++) {
+        memcpy(lcd_shadow + y * lcd_width + r->x0, frame + y * lcd_width + r->x0,
+               width * sizeof(uint16_t));
+    }
+}
+
+// Returns false if nothing had to be sent
+static boolean lcd_present(const uint16_t* frame, boolean* partial) {
+    lcd_rect_t rects[LCD_MAX_HEIGHT];
+    lcd_rect_t full = { 0, 0, lcd_width - 1, lcd_height - 1 };
+    int num_rects = 0;
+    int area = 0;
+
+    *partial = false;
+
+    if (!lcd_shadow_valid || lcd_full_percent <= 0) {
+        lcd_write_rect(frame, &full);
+        lcd_shadow_valid = true;
+        return true;
+    }
+
+    for (int y = 0; y < lcd_height; y++) {
+        const uint16_t* row = frame + y * lcd_width;
+        const uint16_t* old = lcd_shadow + y * lcd_width;
+        int x0 = 0;
+        int x1 = lcd_width - 1;
+
+        while (x0 < lcd_width && row[x0] == old[x0]) x0++;
+        if (x0 == lcd_width) continue;
+        while (row[x1] == old[x1]) x1--;
+
+        lcd_rect_t* last = num_rects ? &rects[num_rects - 1] : NULL;
+
+        if (last && y - last->y1 <= LCD_DIRTY_GAP) {
+            if (x0 < last->x0) last->x0 = x0;
+            if (x1 > last->x1) last->x1 = x1;
+            last->y1 = y;
+        } else {
+            rects[num_rects].x0 = x0;
+            rects[num_rects].x1 = x1;
+            rects[num_rects].y0 = y;
+            rects[num_rects].y1 = y;
+            num_rects++;
         }
     }
 
-    printf("MIDAS LCD initialized!\n");
+    if (num_rects == 0) {
+        return false;
+    }
+
+    for (int i = 0; i < num_rects; i++) {
+        area += (rects[i].x1 - rects[i].x0 + 1) * (rects[i].y1 - rects[i].y0 + 1);
+    }
+
+    if (area * 100 > lcd_full_percent * lcd_width * lcd_height) {
+        lcd_write_rect(frame, &full);
+        return true;
+    }
+
+    for (int i = 0; i < num_rects; i++) {
+        lcd_write_rect(frame, &rects[i]);
+    }
+
+    *partial = true;
+    return true;
+}
+
+static void* lcd_thread_func(void* arg) {
+    pthread_mutex_lock(&lcd_lock);
+
+    for (;;) {
+        while (!lcd_pending) {
+            pthread_cond_wait(&lcd_cond, &lcd_lock);
+        }
+
+        uint16_t* frame = lcd_back;
+        unsigned int frame_number = lcd_stats.submitted;
+        lcd_back = lcd_front;
+        lcd_front = frame;
+        lcd_pending = false;
+
+        pthread_mutex_unlock(&lcd_lock);
+
+        boolean partial;
+        boolean sent = lcd_present(frame, &partial);
+
+#ifdef LCD_SIM
+        lcd_sim_end_frame();
+#endif
+
+        pthread_mutex_lock(&lcd_lock);
+
+        probe_presented(frame_number);
+
+        if (!sent) {
+            lcd_stats.unchanged++;
+        } else {
+            lcd_stats.sent++;
+            if (partial) {
+                lcd_stats.partial++;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void lcd_get_stats(lcd_stats_t* stats) {
+    pthread_mutex_lock(&lcd_lock);
+    *stats = lcd_stats;
+    pthread_mutex_unlock(&lcd_lock);
+}
+
+static void lcd_print_stats() {
+    lcd_stats_t stats;
+
+    lcd_get_stats(&stats);
+    printf("LCD: %u frames submitted, %u sent (%u partial), %u unchanged, %u dropped\n",
+           stats.submitted, stats.sent, stats.partial, stats.unchanged, stats.dropped);
+}
+
+static void* lcd_init_func(void* arg) {
+    v1 = IsVector1();
+    lcd_startup.probe = DG_GetTicksMs() - lcd_startup.start;
+
+    if (v1) {
+        SANTEK_Init();
+    } else {
+        MIDAS_Init();
+    }
+
+    lcd_init_scaler();
+    lcd_startup.panel = DG_GetTicksMs() - lcd_startup.start;
+
+    return NULL;
+}
+
+// Called by the first DG_DrawFrame: wait for the panel, then hand it to
+// the display worker.
+
+static void lcd_start() {
+    lcd_startup.engine = DG_GetTicksMs() - lcd_startup.start;
+
+    pthread_join(lcd_init_thread, NULL);
+
+    if (pthread_create(&lcd_thread, NULL, lcd_thread_func, NULL) != 0) {
+        fprintf(stderr, "Can't start display thread\n");
+        exit(1);
+    }
+
+    lcd_ready = true;
+    lcd_startup.first_frame = DG_GetTicksMs() - lcd_startup.start;
+
+    printf("Startup: LCD ready at %u ms (board probe %u ms), engine ready at %u ms, "
+           "first frame at %u ms\n",
+           lcd_startup.panel, lcd_startup.probe, lcd_startup.engine,
+           lcd_startup.first_frame);
 }
 
 void DG_Init() {
-	v1 = IsVector1();
+    lcd_startup.start = DG_GetTicksMs();
+
+    //!
+    // @arg <model>
+    //
+    // Vector LCD to drive, santek (Vector 1.0) or midas (Vector 2.0),
+    // instead of asking emr-cat.
+    //
+
+    int p = M_CheckParmWithArgs("-lcdmodel", 1);
+    if (p > 0) {
+        lcd_model = myargv[p + 1];
+    }
 
-	if (v1) {
-		SANTEK_Init();
-	} else {
-		MIDAS_Init();
-	}
+    //!
+    // @arg <percent>
+    //
+    // Rewrite the whole LCD instead of just the changed regions once
+    // more than this percentage of it has changed. 0 always sends
+    // full frames. Default is 50.
+    //
+
+    p = M_CheckParmWithArgs("-lcdfull", 1);
+    if (p > 0) {
+        lcd_full_percent = atoi(myargv[p + 1]);
+    }
+
+    if (pthread_create(&lcd_init_thread, NULL, lcd_init_func, NULL) != 0) {
+        fprintf(stderr, "Can't start LCD init thread\n");
+        exit(1);
+    }
+
+    // Not I_AtExit: functions registered before D_DoomMain run after
+    // D_Endoom, which calls exit() itself.
+    atexit(lcd_print_stats);
+    atexit(input_print_stats);
+    atexit(stream_print_stats);
+    atexit(export_print_stats);
 
     udp_sock = socket(AF_INET, SOCK_DGRAM, 0);
     fcntl(udp_sock, F_SETFL, O_NONBLOCK);
@@ -293,37 +716,97 @@ void DG_Init() {
     	return;
 	}
 
+	I_SetInputFd(udp_sock);
+
+    //!
+    // Stream frames back to the remote-control client.
+    //
+
+    if (M_CheckParm("-stream") > 0) {
+        int kbps = 4000;
+
+        //!
+        // @arg <kbps>
+        //
+        // Bandwidth limit for -stream, in kbit/s. Default is 4000.
+        //
+
+        p = M_CheckParmWithArgs("-streamkbps", 1);
+        if (p > 0) {
+            kbps = atoi(myargv[p + 1]);
+        }
+
+        stream_init(udp_sock, kbps);
+    }
+
+    //!
+    // @arg <name>
+    //
+    // Publish frames in the POSIX shared memory object <name> (e.g.
+    // /doom) for other processes, see vector_export.h.
+    //
+
+    p = M_CheckParmWithArgs("-export", 1);
+    if (p > 0) {
+        const char* name = myargv[p + 1];
+        int slots = VE_DEFAULT_SLOTS;
+
+        //!
+        // @arg <n>
+        //
+        // Number of frames kept in the -export ring. Default is 4.
+        //
+
+        p = M_CheckParmWithArgs("-exportslots", 1);
+        if (p > 0) {
+            slots = atoi(myargv[p + 1]);
+        }
+
+        //!
+        // Export RGB565 frames instead of indexed frames and a palette.
+        //
+
+        export_init(name, slots, M_CheckParm("-exportrgb565") > 0
+                                 ? VE_FORMAT_RGB565 : VE_FORMAT_INDEXED);
+    }
+
 	printf("Input server initialized!\n");
 }
 
 void DG_DrawFrame() {
-    uint16_t rgb565_frame[framebuffer_size];
-	memset(rgb565_frame, 0, sizeof(rgb565_frame));
+    if (!lcd_ready) {
+        lcd_start();
+    }
 
-    for (int y = 0; y < (v1 ? 96 : 80); y++) {
-        for (int x = 0; x < (v1 ? 154 : 160); x++) {
-            int src_x = v1 ? (x * 25) / 12 : x * 2;
-            int src_y = v1 ? (y * 25) / 12 : (y * 5) / 2;
-            int src_idx = src_y * 320 + src_x;
+    boolean new_palette = palette_changed;
 
-            uint32_t pixel = DG_ScreenBuffer[src_idx];
+    if (new_palette) {
+        lcd_update_palette();
+    }
 
-            uint8_t r = (pixel >> 16) & 0xFF;
-            uint8_t g = (pixel >> 8) & 0xFF;
-            uint8_t b = pixel & 0xFF;
+    stream_submit(new_palette);
+    export_submit(new_palette);
 
-            uint16_t c = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+    pthread_mutex_lock(&lcd_lock);
 
-			int dst_x = v1 ? (x + 15) : x;
-			int dst_width = v1 ? 184 : 160;
+    for (int y = 0; y < lcd_height; y++) {
+        const uint8_t* src = DG_ScreenBuffer + src_row[y];
+        uint16_t* dst = lcd_back + y * lcd_width + view_x;
 
-            rgb565_frame[y * dst_width + dst_x] = v1 ? c : ((c >> 8) | (c << 8));
+        for (int x = 0; x < view_width; x++) {
+            dst[x] = lcd_palette[src[src_col[x]]];
         }
     }
 
-    static const uint8_t WRITE_RAM = 0x2C;
-    lcd_spi_transfer(1, 1, &WRITE_RAM);
-    lcd_spi_transfer(0, sizeof(rgb565_frame), rgb565_frame);
+    if (lcd_pending) {
+        lcd_stats.dropped++;
+    }
+
+    lcd_stats.submitted++;
+    lcd_pending = true;
+
+    pthread_cond_signal(&lcd_cond);
+    pthread_mutex_unlock(&lcd_lock);
 }
 
 void DG_SleepMs(uint32_t ms) {
@@ -361,23 +844,386 @@ static unsigned char map_key(char c) {
 
 }
 
-int DG_GetKey(int *pressed, unsigned char *key)
-{
-    unsigned char packet[2];
-    ssize_t len = recvfrom(udp_sock, packet, 2, 0, NULL, NULL);
+// Remote input. The socket is drained with recvmmsg, key events are
+// queued in input_keys for DG_GetKey, and mouse and joystick events go
+// straight to D_PostEvent. See vector_input.h for the packet format.
+
+#define INPUT_BATCH 16
+#define INPUT_QUEUE 256
+
+typedef struct {
+    unsigned char pressed;
+    unsigned char key;
+    short probe;        // index into probes, or -1
+} input_key_t;
+
+static input_key_t input_keys[INPUT_QUEUE];
+static unsigned int input_head = 0;
+static unsigned int input_tail = 0;
+
+static boolean input_seq_valid = false;
+static uint32_t input_seq;
+
+static int16_t input_joy[3];
+
+typedef struct {
+    unsigned int packets;
+    unsigned int legacy;
+    unsigned int events;
+    unsigned int lost;
+    unsigned int late;
+    unsigned int overflow;
+    int32_t min_delay;   // local minus client clock, in us
+    int32_t max_delay;
+} input_stats_t;
+
+static input_stats_t input_stats;
+
+// Latency probes, see vi_latency_t. A key event carrying a probe id is
+// given a slot here when received, which follows it through I_GetEvent,
+// G_BuildTiccmd and D_Display (through DG_LatencyHook) to the display
+// worker, which echoes it back to the sender once its frame is on the
+// panel. Guarded by lcd_lock, as the worker finishes them.
+
+#define MAX_PROBES 64
+
+enum {
+    PROBE_FREE,
+    PROBE_RECEIVED,
+    PROBE_EVENT,
+    PROBE_TICCMD,
+    PROBE_DISPLAY,
+};
+
+typedef struct {
+    int state;
+    struct sockaddr_in from;
+    uint32_t received;
+    unsigned int frame;     // first frame showing its effect
+    vi_latency_t echo;
+} probe_t;
+
+static probe_t probes[MAX_PROBES];
+static unsigned int lcd_presented = 0;  // last frame written to the panel
+
+static uint32_t input_time_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
+}
+
+static void probe_finish(probe_t* probe) {
+    probe->echo.stage_us[VI_STAGE_PRESENT] = input_time_us() - probe->received;
+    sendto(udp_sock, &probe->echo, sizeof(probe->echo), 0,
+           (struct sockaddr*) &probe->from, sizeof(probe->from));
+    probe->state = PROBE_FREE;
+}
+
+static void latency_hook(int stage, int tic) {
+    uint32_t now = input_time_us();
+    int i;
+
+    pthread_mutex_lock(&lcd_lock);
+
+    for (i = 0; i < MAX_PROBES; i++) {
+        probe_t* probe = &probes[i];
+
+        if (stage == DG_LATENCY_TICCMD && probe->state == PROBE_EVENT) {
+            probe->echo.tic = tic;
+            probe->echo.stage_us[VI_STAGE_TICCMD] = now - probe->received;
+            probe->state = PROBE_TICCMD;
+        } else if (stage == DG_LATENCY_DISPLAY && probe->state == PROBE_TICCMD
+                && tic > probe->echo.tic) {
+            probe->echo.stage_us[VI_STAGE_DISPLAY] = now - probe->received;
+            probe->frame = lcd_stats.submitted;
+            probe->state = PROBE_DISPLAY;
+
+            // Unchanged frames aren't sent again, the one on the panel
+            // may already be it
+            if (probe->frame <= lcd_presented) {
+                probe_finish(probe);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&lcd_lock);
+}
+
+// Called by the display worker, with lcd_lock held, once frame is on
+// the panel.
+
+static void probe_presented(unsigned int frame) {
+    int i;
+
+    lcd_presented = frame;
+
+    for (i = 0; i < MAX_PROBES; i++) {
+        if (probes[i].state == PROBE_DISPLAY && probes[i].frame <= frame) {
+            probe_finish(&probes[i]);
+        }
+    }
+}
+
+static int probe_start(const struct sockaddr_in* from, uint32_t now,
+                       const vi_event_t* ev) {
+    int i;
+
+    if (ev->x == 0) {
+        return -1;
+    }
+
+    DG_LatencyHook = latency_hook;
+
+    pthread_mutex_lock(&lcd_lock);
+
+    for (i = 0; i < MAX_PROBES; i++) {
+        if (probes[i].state == PROBE_FREE) {
+            break;
+        }
+    }
+
+    if (i < MAX_PROBES) {
+        probe_t* probe = &probes[i];
+
+        memset(probe, 0, sizeof(*probe));
+        probe->state = PROBE_RECEIVED;
+        probe->from = *from;
+        probe->received = now;
+        probe->echo.magic[0] = VI_MAGIC0;
+        probe->echo.magic[1] = VI_MAGIC1;
+        probe->echo.version = VI_VERSION;
+        probe->echo.type = VI_LATENCY;
+        probe->echo.time_us = ev->time_us;
+        probe->echo.id = (uint16_t) ev->x;
+    } else {
+        i = -1;
+    }
+
+    pthread_mutex_unlock(&lcd_lock);
+
+    return i;
+}
+
+static void input_push_key(int pressed, char c, int probe) {
+    unsigned char key = map_key(c);
+
+    if (key == 0 || input_tail - input_head >= INPUT_QUEUE) {
+        if (key != 0) {
+            input_stats.overflow++;
+        }
+
+        if (probe >= 0) {
+            pthread_mutex_lock(&lcd_lock);
+            probes[probe].state = PROBE_FREE;
+            pthread_mutex_unlock(&lcd_lock);
+        }
+
+        return;
+    }
+
+    input_keys[input_tail % INPUT_QUEUE].pressed = pressed;
+    input_keys[input_tail % INPUT_QUEUE].key = key;
+    input_keys[input_tail % INPUT_QUEUE].probe = probe;
+    input_tail++;
+}
+
+// Check the sequence number of a version 2 packet. Packets older than
+// the newest one seen are dropped, so a late key down can't undo the
+// key up that followed it.
+
+static boolean input_check_seq(uint32_t seq) {
+    int32_t delta = (int32_t) (seq - input_seq);
+
+    if (input_seq_valid && seq != 0) {
+        if (delta <= 0) {
+            input_stats.late++;
+            return false;
+        }
+
+        input_stats.lost += delta - 1;
+    } else {
+        // First packet, or the client restarted: the clock offset
+        // changes with it.
+        input_stats.min_delay = INT32_MAX;
+        input_stats.max_delay = INT32_MIN;
+    }
+
+    input_seq = seq;
+    input_seq_valid = true;
+
+    return true;
+}
+
+static void input_read_packet(const unsigned char* buf, size_t len,
+                              const struct sockaddr_in* from, uint32_t now,
+                              int* mouse_x, int* mouse_y, boolean* mouse_moved) {
+    vi_header_t header;
+    vi_event_t ev;
+    event_t event;
+    int32_t delay;
+    int i;
+
+    input_stats.packets++;
 
     if (len == 2) {
-		//printf("%c\n", packet[1]);
+        input_stats.legacy++;
+        input_stats.events++;
+        input_push_key(buf[0], buf[1], -1);
+        return;
+    }
+
+    if (len < sizeof(header)) {
+        return;
+    }
+
+    memcpy(&header, buf, sizeof(header));
 
-        *pressed = packet[0];
-        *key = map_key(packet[1]);
+    if (header.magic[0] != VI_MAGIC0 || header.magic[1] != VI_MAGIC1
+     || header.version != VI_VERSION || header.count > VI_MAX_EVENTS
+     || len < sizeof(header) + header.count * sizeof(ev)) {
+        return;
+    }
+
+    if (!input_check_seq(header.seq)) {
+        return;
+    }
+
+    delay = (int32_t) (now - header.time_us);
+
+    if (delay < input_stats.min_delay) {
+        input_stats.min_delay = delay;
+    }
 
-        if (*key != 0) {
-            return 1;
+    if (delay > input_stats.max_delay) {
+        input_stats.max_delay = delay;
+    }
+
+    for (i = 0; i < header.count; i++) {
+        memcpy(&ev, buf + sizeof(header) + i * sizeof(ev), sizeof(ev));
+        input_stats.events++;
+
+        switch (ev.type) {
+            case VI_KEY_DOWN:
+            case VI_KEY_UP:
+                input_push_key(ev.type == VI_KEY_DOWN, ev.key,
+                               probe_start(from, now, &ev));
+                break;
+
+            case VI_MOUSE:
+                *mouse_x += ev.x;
+                *mouse_y += ev.y;
+                *mouse_moved = true;
+                break;
+
+            case VI_JOYSTICK:
+                if (ev.x == input_joy[0] && ev.y == input_joy[1] && ev.z == input_joy[2]) {
+                    break;
+                }
+
+                input_joy[0] = ev.x;
+                input_joy[1] = ev.y;
+                input_joy[2] = ev.z;
+
+                event.type = ev_joystick;
+                event.data1 = 0;
+                event.data2 = ev.x;
+                event.data3 = ev.y;
+                event.data4 = ev.z;
+                D_PostEvent(&event);
+                break;
+
+            case VI_STREAM:
+                stream_ack(from, (uint16_t) ev.x | ((uint32_t) (uint16_t) ev.y << 16));
+                break;
         }
     }
+}
 
-    return 0;
+static void input_receive() {
+    static unsigned char bufs[INPUT_BATCH][VI_MAX_PACKET];
+    struct sockaddr_in from[INPUT_BATCH];
+    struct mmsghdr msgs[INPUT_BATCH];
+    struct iovec iov[INPUT_BATCH];
+    int mouse_x = 0, mouse_y = 0;
+    boolean mouse_moved = false;
+    event_t event;
+    uint32_t now;
+    int i, n;
+
+    if (udp_sock < 0) {
+        return;
+    }
+
+    do {
+        memset(msgs, 0, sizeof(msgs));
+
+        for (i = 0; i < INPUT_BATCH; i++) {
+            iov[i].iov_base = bufs[i];
+            iov[i].iov_len = sizeof(bufs[i]);
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &from[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+        }
+
+        n = recvmmsg(udp_sock, msgs, INPUT_BATCH, MSG_DONTWAIT, NULL);
+        now = input_time_us();
+
+        for (i = 0; i < n; i++) {
+            if (!(msgs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+                input_read_packet(bufs[i], msgs[i].msg_len, &from[i], now,
+                                  &mouse_x, &mouse_y, &mouse_moved);
+            }
+        }
+    } while (n == INPUT_BATCH);
+
+    if (mouse_moved) {
+        event.type = ev_mouse;
+        event.data1 = 0;
+        event.data2 = mouse_x;
+        event.data3 = mouse_y;
+        event.data4 = 0;
+        D_PostEvent(&event);
+    }
+}
+
+static void input_print_stats() {
+    printf("Input: %u packets (%u version 1), %u events, %u lost, %u late, %u dropped",
+           input_stats.packets, input_stats.legacy, input_stats.events,
+           input_stats.lost, input_stats.late, input_stats.overflow);
+
+    if (input_stats.max_delay >= input_stats.min_delay) {
+        printf(", %d us delivery jitter", input_stats.max_delay - input_stats.min_delay);
+    }
+
+    printf("\n");
+}
+
+int DG_GetKey(int *pressed, unsigned char *key)
+{
+    if (input_head == input_tail) {
+        input_receive();
+    }
+
+    if (input_head == input_tail) {
+        return 0;
+    }
+
+    input_key_t* next = &input_keys[input_head % INPUT_QUEUE];
+
+    if (next->probe >= 0) {
+        pthread_mutex_lock(&lcd_lock);
+        probes[next->probe].echo.stage_us[VI_STAGE_EVENT] =
+            input_time_us() - probes[next->probe].received;
+        probes[next->probe].state = PROBE_EVENT;
+        pthread_mutex_unlock(&lcd_lock);
+    }
+
+    *pressed = next->pressed;
+    *key = next->key;
+    input_head++;
+
+    return 1;
 }
 
 void DG_SetWindowTitle(const char* title) { }
@@ -240,6 +240,15 @@ void F_TextWrite (void)
     src = W_CacheLumpName ( finaleflat , PU_CACHE);
     dest = I_VideoBuffer;
 	
+#ifdef SCREEN_SCALED
+    for (y=0 ; y<SCREENHEIGHT ; y++)
+    {
+	byte *row = src + ((FROMSCREENY(y)&63)<<6);
+
+	for (x=0 ; x<SCREENWIDTH ; x++)
+	    *dest++ = row[FROMSCREENX(x)&63];
+    }
+#else
     for (y=0 ; y<SCREENHEIGHT ; y++)
     {
 	for (x=0 ; x<SCREENWIDTH/64 ; x++)
@@ -253,6 +262,7 @@ void F_TextWrite (void)
 	    dest += (SCREENWIDTH&63);
 	}
     }
+#endif
 
     V_MarkRect (0, 0, SCREENWIDTH, SCREENHEIGHT);
     
@@ -284,7 +294,7 @@ void F_TextWrite (void)
 	}
 		
 	w = SHORT (hu_font[c]->width);
-	if (cx+w > SCREENWIDTH)
+	if (cx+w > ORIGWIDTH)
 	    break;
 	V_DrawPatch(cx, cy, hu_font[c]);
 	cx+=w;
@@ -579,20 +589,23 @@ F_DrawPatchCol
     byte*	dest;
     byte*	desttop;
     int		count;
+    int		y;
 	
     column = (column_t *)((byte *)patch + LONG(patch->columnofs[col]));
     desttop = I_VideoBuffer + x;
 
     // step through the posts in a column
+    // (x is a screen column, the posts are in 320x200 rows)
     while (column->topdelta != 0xff )
     {
 	source = (byte *)column + 3;
-	dest = desttop + column->topdelta*SCREENWIDTH;
-	count = column->length;
+	y = TOSCREENY(column->topdelta);
+	dest = desttop + y*SCREENWIDTH;
+	count = TOSCREENY(column->topdelta + column->length) - y;
 		
 	while (count--)
 	{
-	    *dest = *source++;
+	    *dest = source[FROMSCREENY(y++) - column->topdelta];
 	    dest += SCREENWIDTH;
 	}
 	column = (column_t *)(  (byte *)column + column->length + 4 );
@@ -626,18 +639,18 @@ void F_BunnyScroll (void)
 		
     for ( x=0 ; x<SCREENWIDTH ; x++)
     {
-	if (x+scrolled < 320)
-	    F_DrawPatchCol (x, p1, x+scrolled);
+	if (FROMSCREENX(x)+scrolled < 320)
+	    F_DrawPatchCol (x, p1, FROMSCREENX(x)+scrolled);
 	else
-	    F_DrawPatchCol (x, p2, x+scrolled - 320);		
+	    F_DrawPatchCol (x, p2, FROMSCREENX(x)+scrolled - 320);		
     }
 	
     if (finalecount < 1130)
 	return;
     if (finalecount < 1180)
     {
-        V_DrawPatch((SCREENWIDTH - 13 * 8) / 2,
-                    (SCREENHEIGHT - 8 * 8) / 2, 
+        V_DrawPatch((ORIGWIDTH - 13 * 8) / 2,
+                    (ORIGHEIGHT - 8 * 8) / 2, 
                     W_CacheLumpName(DEH_String("END0"), PU_CACHE));
 	laststage = 0;
 	return;
@@ -653,8 +666,8 @@ void F_BunnyScroll (void)
     }
 	
     DEH_snprintf(name, 10, "END%i", stage);
-    V_DrawPatch((SCREENWIDTH - 13 * 8) / 2, 
-                (SCREENHEIGHT - 8 * 8) / 2, 
+    V_DrawPatch((ORIGWIDTH - 13 * 8) / 2, 
+                (ORIGHEIGHT - 8 * 8) / 2, 
                 W_CacheLumpName (name,PU_CACHE));
 }
 
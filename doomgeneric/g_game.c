@@ -22,6 +22,7 @@
 #include <math.h>
 
 #include "doomdef.h" 
+#include "doomgeneric.h"
 #include "doomkeys.h"
 #include "doomstat.h"
 
@@ -594,6 +595,11 @@ void G_BuildTiccmd (ticcmd_t* cmd, int maketic)
 
         carry = desired_angleturn - cmd->angleturn;
     }
+
+    if (DG_LatencyHook != NULL)
+    {
+        DG_LatencyHook(DG_LATENCY_TICCMD, maketic);
+    }
 } 
  
 
@@ -827,8 +833,9 @@ boolean G_Responder (event_t* ev)
 		 
       case ev_mouse: 
         SetMouseButtons(ev->data1);
-	mousex = ev->data2*(mouseSensitivity+5)/10; 
-	mousey = ev->data3*(mouseSensitivity+5)/10; 
+	// Accumulate, there can be several mouse events per tic
+	mousex += ev->data2*(mouseSensitivity+5)/10; 
+	mousey += ev->data3*(mouseSensitivity+5)/10; 
 	return true;    // eat events 
  
       case ev_joystick: 
@@ -0,0 +1,472 @@
+//
+// Pre-rendered music, see i_musiccache.h.
+//
+// The worker thread is the only one to touch the OPL player and
+// emulator. It renders whichever song was asked for last, a little at a
+// time, appending to the song's chunks and then publishing how far it
+// has got, so the mixer can play a song while the rest of it is still
+// being rendered. If another song is asked for first, it leaves the
+// song where it is; picking it up again means running the emulator from
+// the start without keeping anything up to where it stopped.
+//
+// The game thread converts and looks up songs and hands references to
+// the mixer. The mixer only reads PCM and drops its references. PCM is
+// freed, oldest first, when the worker needs room, and only from songs
+// with no references.
+//
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "i_musiccache.h"
+#include "memio.h"
+#include "mus2mid.h"
+#include "sha1.h"
+
+#include "music/oplplayer.h"
+#include "music/opl.h"
+
+#define CHUNK_FRAMES 65536      // about 3 s at 22050 Hz
+#define MAX_CHUNKS 256          // songs are cut short after this
+#define RENDER_FRAMES 512       // between checks for a newer request
+
+#define CHUNK_BYTES (CHUNK_FRAMES * sizeof(int16_t))
+
+struct music_song_s {
+    music_song_t *next;
+    sha1_digest_t hash;
+    byte *midi;
+    size_t midi_len;
+
+    int16_t *chunks[MAX_CHUNKS];
+    unsigned int num_chunks;
+    unsigned int rendered;      // frames, published to the mixer
+    boolean complete;           // rendered is all of it
+
+    // Under cache_lock
+    boolean queued;
+    unsigned int last_used;
+    int refs;                   // the mixer's and the worker's, atomic
+};
+
+static music_song_t *songs = NULL;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cache_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t rendered_cond = PTHREAD_COND_INITIALIZER;     // for Wait
+static pthread_t worker;
+static boolean worker_running = false;
+static boolean worker_stop = false;
+static unsigned int requests = 0;   // PlaySongs that queued a render
+static unsigned int use_count = 0;
+static music_song_t *rendering = NULL;
+static unsigned int cache_rate;
+static size_t cache_limit;
+static size_t cache_used;           // PCM bytes, all songs
+
+static struct {
+    unsigned int songs;
+    unsigned int lookups;
+    unsigned int hits;          // lump seen before
+    unsigned int plays;
+    unsigned int rendered;      // plays that found the PCM complete
+    unsigned int restarts;      // renders picked up from the start
+    unsigned int evicted;
+    unsigned long long frames;  // rendered, including those run through again
+    double seconds;             // spent rendering them
+} cache_stats;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Free the PCM of songs nobody is using, least recently played first,
+// until there is room for needed more bytes. The song being rendered is
+// always allowed to grow.
+
+static void make_room(size_t needed)
+{
+    while (cache_used + needed > cache_limit) {
+        music_song_t *oldest = NULL;
+
+        for (music_song_t *song = songs; song != NULL; song = song->next) {
+            if (song->num_chunks > 0 && __atomic_load_n(&song->refs, __ATOMIC_ACQUIRE) == 0
+             && (oldest == NULL || song->last_used < oldest->last_used)) {
+                oldest = song;
+            }
+        }
+
+        if (oldest == NULL) {
+            return;
+        }
+
+        for (unsigned int i = 0; i < oldest->num_chunks; i++) {
+            free(oldest->chunks[i]);
+        }
+
+        cache_used -= oldest->num_chunks * CHUNK_BYTES;
+        oldest->num_chunks = 0;
+        __atomic_store_n(&oldest->rendered, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&oldest->complete, false, __ATOMIC_RELAXED);
+        cache_stats.evicted++;
+    }
+}
+
+// Append frames of the player's stereo output to song. Returns false if
+// there is no more room for it.
+
+static boolean store_frames(music_song_t *song, const int16_t *stereo, int frames)
+{
+    unsigned int position = song->rendered;
+
+    for (int i = 0; i < frames; i++, position++) {
+        unsigned int chunk = position / CHUNK_FRAMES;
+
+        if (chunk == song->num_chunks) {
+            if (chunk == MAX_CHUNKS) {
+                return false;
+            }
+
+            pthread_mutex_lock(&cache_lock);
+            make_room(CHUNK_BYTES);
+            song->chunks[chunk] = malloc(CHUNK_BYTES);
+            if (song->chunks[chunk] != NULL) {
+                song->num_chunks++;
+                cache_used += CHUNK_BYTES;
+            }
+            pthread_mutex_unlock(&cache_lock);
+
+            if (song->chunks[chunk] == NULL) {
+                return false;
+            }
+        }
+
+        // The player writes the same to both sides
+        song->chunks[chunk][position % CHUNK_FRAMES] = stereo[i * 2];
+    }
+
+    __atomic_store_n(&song->rendered, position, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&cache_lock);
+    pthread_cond_broadcast(&rendered_cond);
+    pthread_mutex_unlock(&cache_lock);
+
+    return true;
+}
+
+static void render_song(music_song_t *song, unsigned int request)
+{
+    static int16_t buffer[RENDER_FRAMES * 2];
+    unsigned int skip = song->rendered;
+    const void *handle;
+    boolean more = true;
+    double start = now_seconds();
+
+    if (skip > 0) {
+        cache_stats.restarts++;
+    }
+
+    handle = I_OPL_RegisterSong(song->midi, song->midi_len);
+
+    if (handle == NULL) {
+        __atomic_store_n(&song->complete, true, __ATOMIC_RELEASE);
+        return;
+    }
+
+    I_OPL_PlaySong(handle, false);
+
+    while (more && !__atomic_load_n(&worker_stop, __ATOMIC_ACQUIRE)
+        && __atomic_load_n(&requests, __ATOMIC_ACQUIRE) == request) {
+        OPL_Render_Samples(buffer, RENDER_FRAMES);
+        cache_stats.frames += RENDER_FRAMES;
+
+        if (skip >= RENDER_FRAMES) {
+            skip -= RENDER_FRAMES;
+        } else {
+            more = store_frames(song, buffer + skip * 2, RENDER_FRAMES - skip);
+            skip = 0;
+        }
+
+        if (!I_OPL_MusicIsPlaying()) {
+            more = false;
+        }
+    }
+
+    if (!more) {
+        __atomic_store_n(&song->complete, true, __ATOMIC_RELEASE);
+    }
+
+    I_OPL_StopSong();
+    I_OPL_UnRegisterSong(handle);
+
+    cache_stats.seconds += now_seconds() - start;
+}
+
+static void *worker_func(void *arg)
+{
+    // Only the mixer is in a hurry
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10);
+
+    pthread_mutex_lock(&cache_lock);
+
+    while (!worker_stop) {
+        music_song_t *next = NULL;
+        unsigned int request;
+
+        for (music_song_t *song = songs; song != NULL; song = song->next) {
+            // Played again while we were still on it, and finished since
+            if (song->queued && __atomic_load_n(&song->complete, __ATOMIC_ACQUIRE)) {
+                song->queued = false;
+            }
+
+            if (song->queued && (next == NULL || song->last_used > next->last_used)) {
+                next = song;
+            }
+        }
+
+        if (next == NULL) {
+            pthread_cond_wait(&cache_cond, &cache_lock);
+            continue;
+        }
+
+        next->queued = false;
+        __atomic_add_fetch(&next->refs, 1, __ATOMIC_ACQ_REL);
+        rendering = next;
+        request = requests;
+        pthread_mutex_unlock(&cache_lock);
+
+        render_song(next, request);
+        I_MusicCache_ReleaseSong(next);
+
+        // The mixer may have let go of what it was playing since
+        pthread_mutex_lock(&cache_lock);
+        rendering = NULL;
+        pthread_cond_broadcast(&rendered_cond);
+        make_room(0);
+    }
+
+    pthread_mutex_unlock(&cache_lock);
+
+    return NULL;
+}
+
+boolean I_MusicCache_Init(unsigned int rate, size_t cache_size)
+{
+    OPL_Init(rate);
+
+    if (!I_OPL_InitMusic(rate)) {
+        return false;
+    }
+
+    cache_rate = rate;
+    cache_limit = cache_size;
+    worker_stop = false;
+    worker_running = pthread_create(&worker, NULL, worker_func, NULL) == 0;
+
+    return worker_running;
+}
+
+void I_MusicCache_Shutdown(void)
+{
+    if (worker_running) {
+        pthread_mutex_lock(&cache_lock);
+        __atomic_store_n(&worker_stop, true, __ATOMIC_RELEASE);
+        pthread_cond_signal(&cache_cond);
+        pthread_mutex_unlock(&cache_lock);
+
+        pthread_join(worker, NULL);
+        worker_running = false;
+    }
+
+    if (cache_stats.plays > 0) {
+        printf("I_MusicCache_Shutdown: %u songs, %u of %u lookups cached, %u of %u "
+               "plays pre-rendered, %u restarted, %u evicted, %u KB kept\n",
+               cache_stats.songs, cache_stats.hits, cache_stats.lookups,
+               cache_stats.rendered, cache_stats.plays, cache_stats.restarts,
+               cache_stats.evicted, (unsigned int) (cache_used / 1024));
+        printf("I_MusicCache_Shutdown: %.1f s of music rendered in %.2f s\n",
+               (double) cache_stats.frames / cache_rate, cache_stats.seconds);
+    }
+
+    while (songs != NULL) {
+        music_song_t *next = songs->next;
+
+        for (unsigned int i = 0; i < songs->num_chunks; i++) {
+            free(songs->chunks[i]);
+        }
+
+        free(songs->midi);
+        free(songs);
+        songs = next;
+    }
+
+    cache_used = 0;
+    memset(&cache_stats, 0, sizeof(cache_stats));
+
+    I_OPL_ShutdownMusic();
+    OPL_Shutdown();
+}
+
+// MIDI for a lump, which may already be MIDI, in a buffer of our own
+
+static byte *convert_song(void *data, int len, size_t *midi_len)
+{
+    MEMFILE *instream, *outstream;
+    void *outbuf;
+    byte *midi;
+
+    if (len >= 4 && !memcmp(data, "MThd", 4)) {
+        midi = malloc(len);
+        if (midi != NULL) {
+            memcpy(midi, data, len);
+            *midi_len = len;
+        }
+        return midi;
+    }
+
+    instream = mem_fopen_read(data, len);
+    outstream = mem_fopen_write();
+
+    if (mus2mid(instream, outstream)) {
+        printf("Failed to convert MUS to MIDI\n");
+        mem_fclose(instream);
+        mem_fclose(outstream);
+        return NULL;
+    }
+
+    mem_get_buf(outstream, &outbuf, midi_len);
+    midi = malloc(*midi_len);
+
+    if (midi != NULL) {
+        memcpy(midi, outbuf, *midi_len);
+    }
+
+    mem_fclose(instream);
+    mem_fclose(outstream);
+
+    return midi;
+}
+
+music_song_t *I_MusicCache_RegisterSong(void *data, int len)
+{
+    sha1_context_t context;
+    sha1_digest_t hash;
+    music_song_t *song;
+
+    SHA1_Init(&context);
+    SHA1_Update(&context, data, len);
+    SHA1_Final(hash, &context);
+
+    cache_stats.lookups++;
+
+    // Only this thread adds songs
+    for (song = songs; song != NULL; song = song->next) {
+        if (!memcmp(song->hash, hash, sizeof(hash))) {
+            cache_stats.hits++;
+            return song;
+        }
+    }
+
+    song = calloc(1, sizeof(music_song_t));
+    if (song == NULL) {
+        return NULL;
+    }
+
+    song->midi = convert_song(data, len, &song->midi_len);
+    if (song->midi == NULL) {
+        free(song);
+        return NULL;
+    }
+
+    memcpy(song->hash, hash, sizeof(hash));
+    cache_stats.songs++;
+
+    pthread_mutex_lock(&cache_lock);
+    song->next = songs;
+    songs = song;
+    pthread_mutex_unlock(&cache_lock);
+
+    return song;
+}
+
+void I_MusicCache_PlaySong(music_song_t *song)
+{
+    pthread_mutex_lock(&cache_lock);
+
+    __atomic_add_fetch(&song->refs, 1, __ATOMIC_ACQ_REL);
+    song->last_used = ++use_count;
+    cache_stats.plays++;
+
+    if (__atomic_load_n(&song->complete, __ATOMIC_ACQUIRE)) {
+        cache_stats.rendered++;
+    } else if (song != rendering) {
+        song->queued = true;
+        __atomic_add_fetch(&requests, 1, __ATOMIC_RELEASE);
+        pthread_cond_signal(&cache_cond);
+    } else {
+        // Let the worker carry on with it, but if an earlier request
+        // makes it give up, this one is still the newest to render
+        song->queued = true;
+    }
+
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void I_MusicCache_ReleaseSong(music_song_t *song)
+{
+    __atomic_sub_fetch(&song->refs, 1, __ATOMIC_ACQ_REL);
+}
+
+int I_MusicCache_Read(music_song_t *song, unsigned int position,
+                      int16_t *out, int count, boolean *ended)
+{
+    // complete first: once it is set, rendered is final
+    boolean complete = __atomic_load_n(&song->complete, __ATOMIC_ACQUIRE);
+    unsigned int rendered = __atomic_load_n(&song->rendered, __ATOMIC_ACQUIRE);
+    int done = 0;
+
+    while (done < count && position < rendered) {
+        unsigned int offset = position % CHUNK_FRAMES;
+        unsigned int n = count - done;
+
+        if (n > rendered - position) n = rendered - position;
+        if (n > CHUNK_FRAMES - offset) n = CHUNK_FRAMES - offset;
+
+        memcpy(out + done, song->chunks[position / CHUNK_FRAMES] + offset, n * sizeof(int16_t));
+        done += n;
+        position += n;
+    }
+
+    *ended = complete && position >= rendered;
+
+    return done;
+}
+
+boolean I_MusicCache_Wait(music_song_t *song, unsigned int position)
+{
+    boolean result = true;
+
+    pthread_mutex_lock(&cache_lock);
+
+    while (__atomic_load_n(&song->rendered, __ATOMIC_ACQUIRE) < position
+        && !__atomic_load_n(&song->complete, __ATOMIC_ACQUIRE)) {
+        if (song != rendering && !song->queued) {
+            result = false;
+            break;
+        }
+
+        pthread_cond_wait(&rendered_cond, &cache_lock);
+    }
+
+    pthread_mutex_unlock(&cache_lock);
+
+    return result;
+}
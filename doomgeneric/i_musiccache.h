@@ -0,0 +1,43 @@
+//
+// Music for the ALSA module, pre-rendered. Each MUS lump is converted
+// to MIDI once, and played through the OPL emulator on a low priority
+// worker thread into PCM that the mixer then only has to copy out.
+//
+// Songs are found by the SHA-1 of their lump. Their PCM is kept, up to
+// a limit, for when the same song comes round again.
+//
+
+#ifndef __I_MUSICCACHE__
+#define __I_MUSICCACHE__
+
+#include "doomtype.h"
+
+typedef struct music_song_s music_song_t;
+
+// Game thread: start the worker, rendering mono at rate, and keeping up
+// to cache_size bytes of PCM for songs nobody is playing
+boolean I_MusicCache_Init(unsigned int rate, size_t cache_size);
+void I_MusicCache_Shutdown(void);
+
+// Game thread: the song for a MUS or MIDI lump, converted if it's new
+music_song_t *I_MusicCache_RegisterSong(void *data, int len);
+
+// Game thread: take a reference for the mixer, and render the song
+// first if it isn't already
+void I_MusicCache_PlaySong(music_song_t *song);
+
+// Mixer: done with a song it had been handed by PlaySong
+void I_MusicCache_ReleaseSong(music_song_t *song);
+
+// Mixer: copy up to count frames from position into out. Returns how
+// many were there; fewer means the worker is behind or the song has
+// ended, which *ended says.
+int I_MusicCache_Read(music_song_t *song, unsigned int position,
+                      int16_t *out, int count, boolean *ended);
+
+// Mixer, when it mustn't skip anything: wait until the song has been
+// rendered up to position, or has ended before it. Returns false if
+// nothing is rendering it.
+boolean I_MusicCache_Wait(music_song_t *song, unsigned int position);
+
+#endif
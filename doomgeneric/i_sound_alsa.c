@@ -3,128 +3,399 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "config.h"
+#include "d_loop.h"
 #include "doomtype.h"
+#include "i_musiccache.h"
 #include "i_sound.h"
+#include "i_timer.h"
 #include "m_argv.h"
+#include "m_misc.h"
 #include "w_wad.h"
 #include "z_zone.h"
 
-#include "music/oplplayer.h"
-#include "music/opl.h"
-#include "mus2mid.h"
-
 #define SAMPLERATE 22050
 #define NUM_CHANNELS 16
-#define BUFFER_SAMPLES 1024
+#define BUFFER_SAMPLES 1024     // the most mixed at once
+
+// Defaults for -sndperiod and -sndbuffer, in frames: about 12 ms and 46 ms
+#define PERIOD_SAMPLES 256
+#define PCM_BUFFER_SAMPLES 1024
 
 static snd_pcm_t *pcm_handle = NULL;
+static boolean pcm_mmap = false;
+static snd_pcm_uframes_t pcm_period;
+static snd_pcm_uframes_t pcm_buffer;
 static pthread_t audio_thread;
 static boolean audio_thread_running = false;
+static unsigned int mixer_rate = SAMPLERATE;    // what ALSA gave us
+
+// With -sndfile, there is no device and no mixer thread: the game thread
+// mixes as many samples as the tics run so far are worth into a WAV file
+// each frame, however fast or slow the frames come.
+
+static FILE *sound_file = NULL;
+static const char *sound_file_name;
+static int sound_file_start;        // gametic the file starts at
+static unsigned long long sound_file_frames;
+static boolean sound_file_failed;
+
+static struct {
+    double mix_us;          // in mix_period, waits included
+    double wait_us;         // for the music to be rendered
+} file_stats;
+
+// The OPL emulator's own output level, left at 50 (unity) for rendering
+// music into the cache. The music volume is applied by the mixer.
 int mus_opl_gain = 50;
 
+// The mixer thread owns the voices and the music position. The game thread
+// only queues commands for it on cmd_ring, a single producer, single
+// consumer ring the mixer drains at the top of every period, and reads
+// back what it needs to know through channel_done and music_running.
+// Without a mixer thread, commands run straight away.
+
+typedef enum {
+    CMD_START,
+    CMD_STOP,
+    CMD_PARAMS,
+    CMD_MUSIC_PLAY,
+    CMD_MUSIC_STOP,
+    CMD_MUSIC_PAUSE,
+    CMD_MUSIC_RESUME,
+    CMD_MUSIC_VOLUME,
+} mixer_cmd_type_t;
+
 typedef struct {
-    int16_t *data;
+    mixer_cmd_type_t type;
+    int channel;
+    int volume;             // music gain 0-100 for CMD_MUSIC_VOLUME
+    unsigned int serial;    // CMD_START, CMD_MUSIC_PLAY
+    const int16_t *data;
     int length;
-    int position;
-    int volume;
+    int rate;               // of data, for CMD_START
+    music_song_t *song;     // referenced for the mixer
+    boolean looping;
+} mixer_cmd_t;
+
+#define CMD_RING_SIZE 256   // a power of two
+
+static mixer_cmd_t cmd_ring[CMD_RING_SIZE];
+static unsigned int cmd_head = 0;   // written by the game thread only
+static unsigned int cmd_tail = 0;   // written by the mixer only
+
+static struct {
+    unsigned int commands;
+    unsigned int max_queued;
+    unsigned int dropped;   // ring was full
+} cmd_stats;
+
+static struct {
+    unsigned int wakeups;
+    unsigned int underruns;
+    unsigned long long latency_total;   // frames queued ahead of each mix
+    unsigned int latency_max;
+} pcm_stats;
+
+typedef struct {
+    const int16_t *data;
+    unsigned int length;
+    unsigned int position;  // next source sample
+    unsigned int frac;      // and how far past it, 16.16
+    unsigned int step;      // source samples per output sample, 16.16
+    int volume;             // 0-256
+    unsigned int serial;
     boolean active;
 } channel_t;
 
+// Mixer state
+
 static channel_t channels[NUM_CHANNELS];
+static music_song_t *mixer_song = NULL;
+static unsigned int mixer_song_position;
+static boolean mixer_looping;
+static boolean mixer_paused;
+static boolean mixer_song_ended;
+static int music_gain = 100;
+static unsigned int music_stalls;   // periods the music wasn't rendered yet
 static int16_t mix_buffer[BUFFER_SAMPLES];
-static int16_t music_buffer[BUFFER_SAMPLES * 2];
+static int16_t music_buffer[BUFFER_SAMPLES];
+static int16_t voice_buffer[BUFFER_SAMPLES];
+static int32_t mix_accum[BUFFER_SAMPLES];
+
+// Written by the mixer for the game thread: the serial of the last sound
+// to end on each channel, the last song started and whether it still is
+
+static unsigned int channel_done[NUM_CHANNELS];
+static unsigned int music_started = 0;
+static boolean music_running = false;
+
+// Game thread state
+
+static unsigned int channel_serial[NUM_CHANNELS];
+static boolean channel_stopped[NUM_CHANNELS];
+static unsigned int music_serial = 0;
 static boolean music_playing = false;
 
-static boolean I_ALSA_InitMusic(void)
+static void update_music_running(void)
 {
-    OPL_Init(SAMPLERATE);
-    I_OPL_InitMusic(SAMPLERATE);
-    printf("OPL music initialized\n");
-    return true;
+    boolean running = mixer_song != NULL && !mixer_song_ended;
+    __atomic_store_n(&music_running, running, __ATOMIC_RELEASE);
 }
 
-static void I_ALSA_ShutdownMusic(void)
+static void stop_music(void)
 {
-    I_OPL_ShutdownMusic();
-    OPL_Shutdown();
+    if (mixer_song != NULL) {
+        I_MusicCache_ReleaseSong(mixer_song);
+        mixer_song = NULL;
+    }
 }
 
-static void I_ALSA_SetMusicVolume(int volume)
+// Channel volume 0-127 to a multiplier out of 256
+static int mix_volume(int volume)
 {
-    // Volume is 0-15, convert to OPL gain 0-100
-    mus_opl_gain = (volume * 100) / 15;
+    return volume * 256 / 127;
 }
 
-static void I_ALSA_PauseMusic(void)
+static void run_command(const mixer_cmd_t *cmd)
 {
-    I_OPL_PauseSong();
-    music_playing = false;
+    channel_t *ch = &channels[cmd->channel];
+
+    switch (cmd->type) {
+        case CMD_START:
+            ch->data = cmd->data;
+            ch->length = cmd->length;
+            ch->position = 0;
+            ch->frac = 0;
+            ch->step = ((uint64_t) cmd->rate << 16) / mixer_rate;
+            ch->volume = mix_volume(cmd->volume);
+            ch->serial = cmd->serial;
+            ch->active = true;
+            break;
+
+        case CMD_STOP:
+            if (ch->active) {
+                ch->active = false;
+                __atomic_store_n(&channel_done[cmd->channel], ch->serial, __ATOMIC_RELEASE);
+            }
+            break;
+
+        case CMD_PARAMS:
+            ch->volume = mix_volume(cmd->volume);
+            break;
+
+        case CMD_MUSIC_PLAY:
+            stop_music();
+            mixer_song = cmd->song;
+            mixer_song_position = 0;
+            mixer_looping = cmd->looping;
+            mixer_paused = false;
+            mixer_song_ended = false;
+            __atomic_store_n(&music_started, cmd->serial, __ATOMIC_RELEASE);
+            break;
+
+        case CMD_MUSIC_STOP:
+            stop_music();
+            break;
+
+        case CMD_MUSIC_PAUSE:
+            mixer_paused = true;
+            break;
+
+        case CMD_MUSIC_RESUME:
+            mixer_paused = false;
+            break;
+
+        case CMD_MUSIC_VOLUME:
+            music_gain = cmd->volume;
+            break;
+    }
+
+    update_music_running();
 }
 
-static void I_ALSA_ResumeMusic(void)
+// Game thread: queue cmd for the mixer. Never waits; if the mixer has
+// fallen a whole ring behind, the command is dropped and this returns
+// false.
+
+static boolean send_command(const mixer_cmd_t *cmd)
 {
-    I_OPL_ResumeSong();
-    music_playing = true;
+    unsigned int head = cmd_head;
+
+    if (!audio_thread_running) {
+        run_command(cmd);
+        return true;
+    }
+
+    if (head - __atomic_load_n(&cmd_tail, __ATOMIC_ACQUIRE) == CMD_RING_SIZE) {
+        cmd_stats.dropped++;
+        return false;
+    }
+
+    cmd_ring[head % CMD_RING_SIZE] = *cmd;
+    __atomic_store_n(&cmd_head, head + 1, __ATOMIC_RELEASE);
+
+    return true;
 }
 
-static void* I_ALSA_RegisterSong(void *data, int len)
+// Stops, pauses and volume changes the ring had no room for, kept to
+// send again from I_ALSA_UpdateSound. Only the newest command for each
+// channel or for the music matters, so each has one slot that the next
+// command for it replaces.
+
+#define PENDING_STOP(channel)   (channel)
+#define PENDING_PARAMS(channel) (NUM_CHANNELS + (channel))
+#define PENDING_MUSIC_STOP      (NUM_CHANNELS * 2)
+#define PENDING_MUSIC_PAUSE     (NUM_CHANNELS * 2 + 1)     // or resume
+#define PENDING_MUSIC_VOLUME    (NUM_CHANNELS * 2 + 2)
+#define PENDING_SLOTS           (NUM_CHANNELS * 2 + 3)
+
+static mixer_cmd_t pending_cmds[PENDING_SLOTS];
+static boolean pending[PENDING_SLOTS];
+
+static void send_or_keep(const mixer_cmd_t *cmd, int slot)
 {
-    MEMFILE *instream = mem_fopen_read(data, len);
-    MEMFILE *outstream = mem_fopen_write();
+    pending[slot] = !send_command(cmd);
 
-    if (!instream) {
-        printf("Failed to open MUS data\n");
-        return NULL;
+    if (pending[slot]) {
+        pending_cmds[slot] = *cmd;
     }
+}
 
-    if (!outstream) {
-        printf("Failed to open output stream for writing\n");
-        mem_fclose(instream);
-        return NULL;
+static void send_pending(void)
+{
+    for (int i = 0; i < PENDING_SLOTS; i++) {
+        if (pending[i]) {
+            // Still full
+            if (!send_command(&pending_cmds[i])) {
+                return;
+            }
+
+            pending[i] = false;
+        }
     }
+}
 
-    if (mus2mid(instream, outstream)) {
-        printf("Failed to convert MUS to MIDI\n");
-        mem_fclose(instream);
-        mem_fclose(outstream);
-        return NULL;
+// Mixer: apply everything queued since the last period
+
+static void run_commands(void)
+{
+    unsigned int tail = cmd_tail;
+    unsigned int head = __atomic_load_n(&cmd_head, __ATOMIC_ACQUIRE);
+
+    if (head - tail > cmd_stats.max_queued) {
+        cmd_stats.max_queued = head - tail;
     }
 
-    mem_fclose(instream);
+    for (; tail != head; tail++) {
+        run_command(&cmd_ring[tail % CMD_RING_SIZE]);
+        cmd_stats.commands++;
+    }
 
-    void *midi_data;
-    size_t midi_len;
-    mem_get_buf(outstream, &midi_data, &midi_len);
+    __atomic_store_n(&cmd_tail, tail, __ATOMIC_RELEASE);
+}
 
-    const void *handle = I_OPL_RegisterSong(midi_data, midi_len);
+static boolean I_ALSA_InitMusic(void)
+{
+    int cache_mb = 32;
+    int i;
+
+    //!
+    // @arg <mb>
+    //
+    // Keep up to this much rendered music, in megabytes, for songs that
+    // aren't playing, 32 by default. A minute is about 2.5 MB.
+    //
+
+    i = M_CheckParmWithArgs("-musiccache", 1);
+    if (i > 0) {
+        cache_mb = atoi(myargv[i + 1]);
+    }
 
-    mem_fclose(outstream);
+    if (!I_MusicCache_Init(mixer_rate, (size_t) cache_mb * 1024 * 1024)) {
+        fprintf(stderr, "OPL music failed to initialize\n");
+        return false;
+    }
+
+    printf("OPL music initialized, %d MB cache\n", cache_mb);
+    return true;
+}
 
-    return (void *)handle;
+static void I_ALSA_ShutdownMusic(void)
+{
+    I_MusicCache_Shutdown();
+}
+
+static void I_ALSA_SetMusicVolume(int volume)
+{
+    // Volume is 0-15, convert to gain 0-100
+    send_or_keep(&(mixer_cmd_t) { .type = CMD_MUSIC_VOLUME, .volume = (volume * 100) / 15 },
+                 PENDING_MUSIC_VOLUME);
+}
+
+static void I_ALSA_PauseMusic(void)
+{
+    send_or_keep(&(mixer_cmd_t) { .type = CMD_MUSIC_PAUSE }, PENDING_MUSIC_PAUSE);
+    music_playing = false;
+}
+
+static void I_ALSA_ResumeMusic(void)
+{
+    send_or_keep(&(mixer_cmd_t) { .type = CMD_MUSIC_RESUME }, PENDING_MUSIC_PAUSE);
+    music_playing = true;
+}
+
+static void* I_ALSA_RegisterSong(void *data, int len)
+{
+    return I_MusicCache_RegisterSong(data, len);
 }
 
 static void I_ALSA_UnRegisterSong(void *handle)
 {
-    I_OPL_UnRegisterSong(handle);
+    // Songs stay in the cache, for when the lump is played again
 }
 
 static void I_ALSA_PlaySong(void *handle, boolean looping)
 {
-    I_OPL_PlaySong(handle, looping);
+    if (handle == NULL) {
+        return;
+    }
+
+    I_MusicCache_PlaySong(handle);
+
+    if (!send_command(&(mixer_cmd_t) {
+        .type = CMD_MUSIC_PLAY, .song = handle, .looping = looping, .serial = ++music_serial
+    })) {
+        I_MusicCache_ReleaseSong(handle);
+        return;
+    }
+
+    // Starting a song stops the last one and unpauses
+    pending[PENDING_MUSIC_STOP] = false;
+    pending[PENDING_MUSIC_PAUSE] = false;
     music_playing = true;
 }
 
 static void I_ALSA_StopSong(void)
 {
-    I_OPL_StopSong();
+    send_or_keep(&(mixer_cmd_t) { .type = CMD_MUSIC_STOP }, PENDING_MUSIC_STOP);
     music_playing = false;
 }
 
 static boolean I_ALSA_MusicIsPlaying(void)
 {
-    return music_playing && I_OPL_MusicIsPlaying();
+    if (!music_playing) {
+        return false;
+    }
+
+    // Still to be started by the mixer
+    if (__atomic_load_n(&music_started, __ATOMIC_ACQUIRE) != music_serial) {
+        return true;
+    }
+
+    return __atomic_load_n(&music_running, __ATOMIC_ACQUIRE);
 }
 
 music_module_t DG_music_module = {
@@ -143,98 +414,693 @@ music_module_t DG_music_module = {
     NULL,
 };
 
-static int16_t* convert_sound(byte *data, int length)
+// Converted sound effects, found through sfxinfo->driver_data and kept
+// until I_ALSA_ShutdownSound. They are converted on first use, or all
+// at startup with -precachesfx, into chunks of one arena that is only
+// ever added to, so channels can play from it without owning anything.
+
+#define SFX_ARENA_CHUNK (256 * 1024)
+
+typedef struct alsa_sfx_s alsa_sfx_t;
+
+struct alsa_sfx_s {
+    sfxinfo_t *sfxinfo;
+    alsa_sfx_t *next;
+    int length;
+    int rate;
+    int16_t samples[];
+};
+
+typedef struct sfx_chunk_s sfx_chunk_t;
+
+struct sfx_chunk_s {
+    sfx_chunk_t *next;
+    size_t size;
+    size_t used;
+};
+
+static sfx_chunk_t *sfx_chunks = NULL;
+static alsa_sfx_t *sfx_cached = NULL;
+
+static struct {
+    unsigned int sounds;
+    unsigned int chunks;
+    size_t reserved;        // bytes malloc'd for chunks
+    size_t used;            // bytes handed out of them
+    unsigned int starts;
+    unsigned int hits;      // starts that found the sound converted
+} sfx_stats;
+
+static void *sfx_alloc(size_t size)
 {
-    int16_t *converted = malloc(length * sizeof(int16_t));
-    if (!converted) return NULL;
+    sfx_chunk_t *chunk = sfx_chunks;
+    void *result;
 
-    for (int i = 0; i < length; i++) {
-        int16_t sample = data[i] << 8;
-        sample ^= 0x8000;
-        converted[i] = sample;
+    size = (size + 7) & ~(size_t) 7;
+
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        size_t chunk_size = sizeof(sfx_chunk_t) + size;
+
+        if (chunk_size < SFX_ARENA_CHUNK) {
+            chunk_size = SFX_ARENA_CHUNK;
+        }
+
+        chunk = malloc(chunk_size);
+        if (chunk == NULL) return NULL;
+
+        chunk->size = chunk_size;
+        chunk->used = (sizeof(sfx_chunk_t) + 7) & ~(size_t) 7;
+
+        // Keep filling the chunk with the most room left
+        if (sfx_chunks != NULL && sfx_chunks->size - sfx_chunks->used > chunk_size - chunk->used - size) {
+            chunk->next = sfx_chunks->next;
+            sfx_chunks->next = chunk;
+        } else {
+            chunk->next = sfx_chunks;
+            sfx_chunks = chunk;
+        }
+
+        sfx_stats.chunks++;
+        sfx_stats.reserved += chunk_size;
     }
 
-    return converted;
+    result = (byte *) chunk + chunk->used;
+    chunk->used += size;
+    sfx_stats.used += size;
+
+    return result;
 }
 
-static void* audio_thread_func(void *arg)
+// Convert the sound's 8-bit unsigned lump to signed 16-bit, once. It
+// keeps its own sample rate; the mixer steps through it at that rate.
+
+static alsa_sfx_t *cache_sound(sfxinfo_t *sfxinfo, int lumpnum)
 {
-    while (audio_thread_running) {
-        memset(mix_buffer, 0, sizeof(mix_buffer));
-
-        // First, render music into mix_buffer if playing
-        if (music_playing) {
-            OPL_Render_Samples(music_buffer, BUFFER_SAMPLES);
-            // Convert stereo to mono and add to mix buffer
-            for (int s = 0; s < BUFFER_SAMPLES; s++) {
-                int music_sample = (music_buffer[s * 2] + music_buffer[s * 2 + 1]) / 2;
-                // Scale music down a bit to leave headroom for sound effects
-                mix_buffer[s] = (music_sample * mus_opl_gain) / 100;
+    alsa_sfx_t *snd;
+    byte *data;
+    int lumplen, length, rate;
+
+    if (sfxinfo->driver_data != NULL) {
+        sfx_stats.hits++;
+        return sfxinfo->driver_data;
+    }
+
+    data = W_CacheLumpNum(lumpnum, PU_STATIC);
+    lumplen = W_LumpLength(lumpnum);
+
+    // DMX header: format 3, sample rate, sample count
+    if (lumplen < 8 || data[0] != 0x03 || data[1] != 0x00) {
+        W_ReleaseLumpNum(lumpnum);
+        return NULL;
+    }
+
+    rate = (data[3] << 8) | data[2];
+    length = (data[7] << 24) | (data[6] << 16) | (data[5] << 8) | data[4];
+
+    if (rate == 0 || length > lumplen - 8 || length <= 48) {
+        W_ReleaseLumpNum(lumpnum);
+        return NULL;
+    }
+
+    // DMX skips the 16 bytes of padding at either end
+    data += 8 + 16;
+    length -= 32;
+
+    snd = sfx_alloc(sizeof(alsa_sfx_t) + length * sizeof(int16_t));
+
+    if (snd != NULL) {
+        for (int i = 0; i < length; i++) {
+            int16_t sample = data[i] << 8;
+            sample ^= 0x8000;
+            snd->samples[i] = sample;
+        }
+
+        snd->sfxinfo = sfxinfo;
+        snd->length = length;
+        snd->rate = rate;
+        snd->next = sfx_cached;
+        sfx_cached = snd;
+        sfxinfo->driver_data = snd;
+        sfx_stats.sounds++;
+    }
+
+    W_ReleaseLumpNum(lumpnum);
+
+    return snd;
+}
+
+static void free_sounds(void)
+{
+    if (sfx_stats.sounds > 0) {
+        printf("I_ALSA_ShutdownSound: %u sounds cached in %u KB (%u KB reserved "
+               "in %u chunks), %u of %u starts cached\n",
+               sfx_stats.sounds, (unsigned int) (sfx_stats.used / 1024),
+               (unsigned int) (sfx_stats.reserved / 1024), sfx_stats.chunks,
+               sfx_stats.hits, sfx_stats.starts);
+    }
+
+    for (alsa_sfx_t *snd = sfx_cached; snd != NULL; snd = snd->next) {
+        snd->sfxinfo->driver_data = NULL;
+    }
+
+    while (sfx_chunks != NULL) {
+        sfx_chunk_t *next = sfx_chunks->next;
+        free(sfx_chunks);
+        sfx_chunks = next;
+    }
+
+    sfx_cached = NULL;
+    memset(&sfx_stats, 0, sizeof(sfx_stats));
+}
+
+// Each period, every voice is resampled to the output rate by stepping
+// a 16.16 phase through it (taking the nearest sample, as DMX did) and
+// added into a 32-bit accumulator along with the music. Only the total
+// is clamped, once, on the way out. The loops over a period have no
+// branches and, but for the last, run a multiple of 8 samples (the
+// buffers have room for the extra) so that they vectorize.
+
+// Fill out with the next count samples of ch, zero padded past its end,
+// and move it on. Returns false once it has ended.
+
+static boolean resample_voice(channel_t *ch, int16_t *restrict out, int count)
+{
+    const int16_t *src = ch->data + ch->position;
+    uint64_t left = ((uint64_t) (ch->length - ch->position) << 16) - ch->frac;
+    uint32_t phase = ch->frac;
+    int n = count;
+
+    if (left < (uint64_t) ch->step * count) {
+        n = (left + ch->step - 1) / ch->step;
+    }
+
+    for (int s = 0; s < n; s++) {
+        out[s] = src[phase >> 16];
+        phase += ch->step;
+    }
+
+    memset(out + n, 0, (count - n) * sizeof(int16_t));
+
+    ch->position += phase >> 16;
+    ch->frac = phase & 0xffff;
+
+    return ch->position < ch->length;
+}
+
+static void mix_add(int32_t *restrict accum, const int16_t *restrict samples,
+                    int volume, int count)
+{
+    for (int s = 0; s < count; s++) {
+        accum[s] += (samples[s] * volume) >> 8;
+    }
+}
+
+// Gain out of 256
+static void mix_music(int32_t *restrict accum, const int16_t *restrict samples,
+                      int gain, int count)
+{
+    for (int s = 0; s < count; s++) {
+        accum[s] = (samples[s] * gain) >> 8;
+    }
+}
+
+static double mix_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+// Copy the next count samples of the song into music_buffer, going
+// round again at the end if it loops. Silence where the worker hasn't
+// got to yet; the song waits for it. Writing to a file, the mixer waits
+// for the worker instead.
+
+static void read_music(int count)
+{
+    int done = 0;
+
+    while (done < count) {
+        boolean ended;
+        int n = I_MusicCache_Read(mixer_song, mixer_song_position,
+                                  music_buffer + done, count - done, &ended);
+
+        done += n;
+        mixer_song_position += n;
+
+        if (!ended) {
+            if (done < count && sound_file != NULL) {
+                double start = mix_time_us();
+                boolean rendering = I_MusicCache_Wait(mixer_song, mixer_song_position + count - done);
+
+                file_stats.wait_us += mix_time_us() - start;
+
+                if (rendering) {
+                    continue;
+                }
+            }
+
+            if (done < count) {
+                music_stalls++;
             }
+            break;
+        }
+
+        if (!mixer_looping || mixer_song_position == 0) {
+            mixer_song_ended = true;
+            break;
         }
 
-        // Mix all active sound channels on top of music
+        mixer_song_position = 0;
+    }
+
+    memset(music_buffer + done, 0, (count - done) * sizeof(int16_t));
+}
+
+static void mix_saturate(int16_t *restrict out, const int32_t *restrict accum, int count)
+{
+    for (int s = 0; s < count; s++) {
+        int32_t sample = accum[s];
+        sample = sample < -32768 ? -32768 : sample;
+        sample = sample > 32767 ? 32767 : sample;
+        out[s] = sample;
+    }
+}
+
+// Samples past count are left over from before, and never make it out
+static boolean mix_voice(channel_t *ch, int count)
+{
+    boolean more = resample_voice(ch, voice_buffer, count);
+    mix_add(mix_accum, voice_buffer, ch->volume, (count + 7) & ~7);
+    return more;
+}
+
+// Mix the next count samples, at most BUFFER_SAMPLES, into out
+static void mix_period(int16_t *out, int count)
+{
+    if (mixer_song != NULL && !mixer_paused && !mixer_song_ended) {
+        read_music(count);
+        // Scale music down a bit to leave headroom for sound effects
+        mix_music(mix_accum, music_buffer, music_gain * 256 / 100, (count + 7) & ~7);
+    } else {
+        memset(mix_accum, 0, sizeof(mix_accum));
+    }
+
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        if (!channels[i].active) continue;
+
+        if (!mix_voice(&channels[i], count)) {
+            channels[i].active = false;
+            __atomic_store_n(&channel_done[i], channels[i].serial, __ATOMIC_RELEASE);
+        }
+    }
+
+    mix_saturate(out, mix_accum, count);
+}
+
+// The mixer as it was, one source sample per output sample and a clamp
+// after every add, kept to compare against with -mixbench
+
+static void mix_period_clamped(channel_t *voices, int16_t *out)
+{
+    memset(out, 0, BUFFER_SAMPLES * sizeof(int16_t));
+
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        for (int s = 0; s < BUFFER_SAMPLES && voices[i].position < voices[i].length; s++) {
+            int sample = voices[i].data[voices[i].position];
+            sample = (sample * voices[i].volume) / 127;
+
+            int mixed = out[s] + sample;
+
+            if (mixed > 32767) mixed = 32767;
+            if (mixed < -32768) mixed = -32768;
+            out[s] = mixed;
+
+            voices[i].position++;
+        }
+    }
+}
+
+// Time mixing a period with all channels playing, both ways. Runs
+// before the mixer thread starts, so it can borrow its buffers.
+
+#define MIX_BENCH_PERIODS 2000
+
+static void mix_benchmark(void)
+{
+    static int16_t source[BUFFER_SAMPLES * 2];
+    channel_t voices[NUM_CHANNELS];
+    double start, clamped, accumulated;
+
+    for (int i = 0; i < BUFFER_SAMPLES * 2; i++) {
+        source[i] = rand();
+    }
+
+    start = mix_time_us();
+
+    for (int n = 0; n < MIX_BENCH_PERIODS; n++) {
         for (int i = 0; i < NUM_CHANNELS; i++) {
-            if (!channels[i].active || !channels[i].data) continue;
+            voices[i] = (channel_t) {
+                .data = source, .length = BUFFER_SAMPLES * 2, .volume = 100
+            };
+        }
 
-            for (int s = 0; s < BUFFER_SAMPLES && channels[i].position < channels[i].length; s++) {
-                int sample = channels[i].data[channels[i].position];
-                // Apply channel volume (0-127 scale)
-                sample = (sample * channels[i].volume) / 127;
+        mix_period_clamped(voices, mix_buffer);
+    }
 
-                // ADD to mix buffer (don't replace!)
-                int mixed = mix_buffer[s] + sample;
+    clamped = (mix_time_us() - start) / MIX_BENCH_PERIODS;
+    start = mix_time_us();
 
-                // Clamp to prevent distortion
-                if (mixed > 32767) mixed = 32767;
-                if (mixed < -32768) mixed = -32768;
-                mix_buffer[s] = mixed;
+    for (int n = 0; n < MIX_BENCH_PERIODS; n++) {
+        memset(mix_accum, 0, sizeof(mix_accum));
 
-                channels[i].position++;
-            }
+        // Half at 11025 Hz, half at 22050 Hz, as in the IWADs
+        for (int i = 0; i < NUM_CHANNELS; i++) {
+            voices[i] = (channel_t) {
+                .data = source, .length = BUFFER_SAMPLES * 2,
+                .step = ((uint64_t) (i & 1 ? 22050 : 11025) << 16) / mixer_rate,
+                .volume = mix_volume(100)
+            };
+
+            mix_voice(&voices[i], BUFFER_SAMPLES);
+        }
 
-            if (channels[i].position >= channels[i].length) {
-                channels[i].active = false;
+        mix_saturate(mix_buffer, mix_accum, BUFFER_SAMPLES);
+    }
+
+    accumulated = (mix_time_us() - start) / MIX_BENCH_PERIODS;
+
+    printf("I_ALSA_InitSound: mixing %d channels, %d samples: %.1f us per period "
+           "clamping each add, %.1f us accumulating\n", NUM_CHANNELS, BUFFER_SAMPLES,
+           clamped, accumulated);
+}
+
+// Mix frames straight into the device's ring, or through mix_buffer if
+// it can't be mapped
+
+static int write_frames(snd_pcm_uframes_t frames)
+{
+    while (frames > 0) {
+        snd_pcm_uframes_t count = frames < BUFFER_SAMPLES ? frames : BUFFER_SAMPLES;
+        snd_pcm_sframes_t written;
+
+        if (pcm_mmap) {
+            const snd_pcm_channel_area_t *areas;
+            snd_pcm_uframes_t offset;
+            int err = snd_pcm_mmap_begin(pcm_handle, &areas, &offset, &count);
+
+            if (err < 0) return err;
+
+            mix_period((int16_t *) ((byte *) areas[0].addr
+                                    + (areas[0].first + offset * areas[0].step) / 8), count);
+            written = snd_pcm_mmap_commit(pcm_handle, offset, count);
+        } else {
+            mix_period(mix_buffer, count);
+            written = snd_pcm_writei(pcm_handle, mix_buffer, count);
+        }
+
+        if (written < 0) return written;
+        if ((snd_pcm_uframes_t) written != count) return -EPIPE;
+
+        frames -= count;
+    }
+
+    return 0;
+}
+
+static void underrun(int err)
+{
+    if (err == -EPIPE) {
+        pcm_stats.underruns++;
+    }
+
+    snd_pcm_recover(pcm_handle, err, 1);
+}
+
+// The null plugin and files take everything at once. Don't get more
+// than a buffer ahead of the clock, as a card wouldn't let us.
+
+static void pace(unsigned long long mixed, const struct timespec *start)
+{
+    struct timespec now;
+    long long elapsed, ahead;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - start->tv_sec) * 1000000000LL + now.tv_nsec - start->tv_nsec;
+    ahead = (long long) mixed - elapsed * mixer_rate / 1000000000 - (long long) pcm_buffer;
+
+    if (ahead > 0) {
+        struct timespec delay = {
+            ahead / mixer_rate, (ahead % mixer_rate) * 1000000000LL / mixer_rate
+        };
+        nanosleep(&delay, NULL);
+    }
+}
+
+// Sleep until the device wants a period, then mix exactly as much as it
+// has room for: everything queued is as fresh as it can be.
+
+static void* audio_thread_func(void *arg)
+{
+    unsigned long long mixed = 0;
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (__atomic_load_n(&audio_thread_running, __ATOMIC_ACQUIRE)) {
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm_handle);
+        snd_pcm_sframes_t delay;
+        int err;
+
+        if (avail < 0) {
+            underrun(avail);
+            continue;
+        }
+
+        if ((snd_pcm_uframes_t) avail < pcm_period) {
+            err = snd_pcm_wait(pcm_handle, 100);
+            if (err < 0) {
+                underrun(err);
             }
+            continue;
         }
 
-        // Write to ALSA
-        if (pcm_handle) {
-            int err = snd_pcm_writei(pcm_handle, mix_buffer, BUFFER_SAMPLES);
-            if (err == -EPIPE) {
-                snd_pcm_prepare(pcm_handle);
-            } else if (err < 0) {
-                snd_pcm_recover(pcm_handle, err, 0);
+        pcm_stats.wakeups++;
+
+        // New sounds play after whatever is still queued
+        if (snd_pcm_delay(pcm_handle, &delay) == 0 && delay >= 0) {
+            pcm_stats.latency_total += delay;
+            if (delay > pcm_stats.latency_max) {
+                pcm_stats.latency_max = delay;
             }
         }
+
+        run_commands();
+
+        err = write_frames(avail);
+        if (err < 0) {
+            underrun(err);
+        }
+
+        update_music_running();
+
+        mixed += avail;
+        pace(mixed, &start);
     }
     return NULL;
 }
 
+// RIFF header for 16-bit mono PCM, frames long
+
+static void write_wav_header(unsigned long long frames)
+{
+    uint32_t data_size = frames * sizeof(int16_t);
+    byte header[44];
+
+    memcpy(header, "RIFF\0\0\0\0WAVEfmt \x10\0\0\0\x01\0\x01\0", 24);
+    memcpy(header + 36, "data", 4);
+
+    for (int i = 0; i < 4; i++) {
+        header[4 + i] = (data_size + 36) >> (8 * i);
+        header[24 + i] = mixer_rate >> (8 * i);
+        header[28 + i] = (mixer_rate * sizeof(int16_t)) >> (8 * i);
+        header[40 + i] = data_size >> (8 * i);
+    }
+
+    header[32] = sizeof(int16_t);       // block align
+    header[33] = 0;
+    header[34] = 16;                    // bits per sample
+    header[35] = 0;
+
+    fseek(sound_file, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), sound_file);
+}
+
+static boolean open_sound_file(const char *filename)
+{
+    sound_file = fopen(filename, "wb");
+    if (sound_file == NULL) {
+        fprintf(stderr, "I_ALSA_InitSound: Couldn't open %s\n", filename);
+        return false;
+    }
+
+    sound_file_name = filename;
+    sound_file_start = gametic;
+    sound_file_frames = 0;
+    sound_file_failed = false;
+    mixer_rate = SAMPLERATE;
+
+    // Filled in again on shutdown, when the length is known
+    write_wav_header(0);
+
+    printf("I_ALSA_InitSound: Writing sound to %s (mono) at %d Hz\n", filename, SAMPLERATE);
+    return true;
+}
+
+// Mix up to the current tic into the file. The sound is timed by the
+// tics, not by the clock, so the same demo writes the same file however
+// fast it ran.
+
+static void write_sound_file(void)
+{
+    unsigned long long target = (unsigned long long) (gametic - sound_file_start)
+                              * mixer_rate / TICRATE;
+    double start;
+
+    if (gametic < sound_file_start || sound_file_frames >= target) {
+        return;
+    }
+
+    start = mix_time_us();
+
+    while (sound_file_frames < target) {
+        int count = target - sound_file_frames < BUFFER_SAMPLES
+                  ? target - sound_file_frames : BUFFER_SAMPLES;
+
+        mix_period(mix_buffer, count);
+        update_music_running();
+
+        if (!sound_file_failed
+         && fwrite(mix_buffer, sizeof(int16_t), count, sound_file) != (size_t) count) {
+            fprintf(stderr, "I_ALSA_UpdateSound: Error writing %s\n", sound_file_name);
+            sound_file_failed = true;
+        }
+
+        sound_file_frames += count;
+    }
+
+    file_stats.mix_us += mix_time_us() - start;
+}
+
+static void close_sound_file(void)
+{
+    if (!sound_file_failed) {
+        write_wav_header(sound_file_frames);
+    }
+
+    if (fclose(sound_file) != 0 && !sound_file_failed) {
+        fprintf(stderr, "I_ALSA_ShutdownSound: Error writing %s\n", sound_file_name);
+    }
+
+    printf("I_ALSA_ShutdownSound: %.1f s of sound for %d tics written to %s, "
+           "%.1f ms mixing and %.1f ms waiting for music\n",
+           (double) sound_file_frames / mixer_rate, gametic - sound_file_start,
+           sound_file_name, (file_stats.mix_us - file_stats.wait_us) / 1000.0,
+           file_stats.wait_us / 1000.0);
+
+    if (music_stalls > 0) {
+        printf("I_ALSA_ShutdownSound: music wasn't rendered in %u periods\n",
+               music_stalls);
+    }
+
+    sound_file = NULL;
+    memset(&file_stats, 0, sizeof(file_stats));
+}
+
 static boolean I_ALSA_InitSound(boolean _use_sfx_prefix)
 {
-    int err;
+    const char *device = "hw:0,0";
+    int err, i;
     snd_pcm_hw_params_t *hw_params;
+    snd_pcm_sw_params_t *sw_params;
+
+    //!
+    // @arg <file>
+    //
+    // Write the sound to a WAV file instead of playing it, in step with
+    // the game's tics rather than the clock. With -timedemo, the demo's
+    // sound is mixed as fast as the demo runs, and comes out the same
+    // every time.
+    //
+
+    i = M_CheckParmWithArgs("-sndfile", 1);
+    if (i > 0) {
+        return open_sound_file(myargv[i + 1]);
+    }
 
     printf("I_ALSA_InitSound: Initializing ALSA (mono) at %d Hz\n", SAMPLERATE);
 
-    err = snd_pcm_open(&pcm_handle, "hw:0,0", SND_PCM_STREAM_PLAYBACK, 0);
+    //!
+    // @arg <device>
+    //
+    // ALSA device to play sound on, hw:0,0 by default. null plays to
+    // nowhere, for testing without a sound card.
+    //
+
+    i = M_CheckParmWithArgs("-snddevice", 1);
+    if (i > 0) {
+        device = myargv[i + 1];
+    }
+
+    //!
+    // @arg <frames>
+    //
+    // Mix this many frames at a time, 256 by default. Smaller periods
+    // pick up new sounds sooner, at the cost of more wakeups.
+    //
+
+    pcm_period = PERIOD_SAMPLES;
+    i = M_CheckParmWithArgs("-sndperiod", 1);
+    if (i > 0) {
+        pcm_period = atoi(myargv[i + 1]);
+    }
+
+    //!
+    // @arg <frames>
+    //
+    // Size of the ALSA buffer, 1024 frames by default. This is the most
+    // sound that is ever queued, and how long the mixer can be held up
+    // before it underruns.
+    //
+
+    pcm_buffer = PCM_BUFFER_SAMPLES;
+    i = M_CheckParmWithArgs("-sndbuffer", 1);
+    if (i > 0) {
+        pcm_buffer = atoi(myargv[i + 1]);
+    }
+
+    err = snd_pcm_open(&pcm_handle, device, SND_PCM_STREAM_PLAYBACK, 0);
     if (err < 0) {
-        fprintf(stderr, "ALSA open failed: %s\n", snd_strerror(err));
+        fprintf(stderr, "ALSA open of %s failed: %s\n", device, snd_strerror(err));
         return false;
     }
 
     snd_pcm_hw_params_alloca(&hw_params);
     snd_pcm_hw_params_any(pcm_handle, hw_params);
-    snd_pcm_hw_params_set_access(pcm_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
+
+    pcm_mmap = snd_pcm_hw_params_set_access(pcm_handle, hw_params,
+                                            SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0;
+    if (!pcm_mmap) {
+        snd_pcm_hw_params_set_access(pcm_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
+    }
+
     snd_pcm_hw_params_set_format(pcm_handle, hw_params, SND_PCM_FORMAT_S16_LE);
     snd_pcm_hw_params_set_channels(pcm_handle, hw_params, 1); // MONO
 
     unsigned int rate = SAMPLERATE;
     snd_pcm_hw_params_set_rate_near(pcm_handle, hw_params, &rate, 0);
-
-    snd_pcm_uframes_t period_size = BUFFER_SAMPLES;
-    snd_pcm_hw_params_set_period_size_near(pcm_handle, hw_params, &period_size, 0);
+    snd_pcm_hw_params_set_period_size_near(pcm_handle, hw_params, &pcm_period, 0);
+    snd_pcm_hw_params_set_buffer_size_near(pcm_handle, hw_params, &pcm_buffer);
 
     err = snd_pcm_hw_params(pcm_handle, hw_params);
     if (err < 0) {
@@ -243,28 +1109,71 @@ static boolean I_ALSA_InitSound(boolean _use_sfx_prefix)
         return false;
     }
 
+    snd_pcm_hw_params_get_period_size(hw_params, &pcm_period, 0);
+    snd_pcm_hw_params_get_buffer_size(hw_params, &pcm_buffer);
+
+    // Wake for every period, and start playing once the buffer is full
+    snd_pcm_sw_params_alloca(&sw_params);
+    snd_pcm_sw_params_current(pcm_handle, sw_params);
+    snd_pcm_sw_params_set_avail_min(pcm_handle, sw_params, pcm_period);
+    snd_pcm_sw_params_set_start_threshold(pcm_handle, sw_params, pcm_buffer);
+    snd_pcm_sw_params(pcm_handle, sw_params);
+
     snd_pcm_prepare(pcm_handle);
-    memset(channels, 0, sizeof(channels));
+    mixer_rate = rate;
+
+    //!
+    // Time the sound effect mixer at startup.
+    //
+
+    if (M_ParmExists("-mixbench")) {
+        mix_benchmark();
+    }
 
     audio_thread_running = true;
     pthread_create(&audio_thread, NULL, audio_thread_func, NULL);
 
-    printf("ALSA initialized: mono, %d Hz\n", rate);
+    printf("ALSA initialized: %s, mono, %d Hz, %s, period %lu, buffer %lu frames\n",
+           device, rate, pcm_mmap ? "mmap" : "read/write",
+           (unsigned long) pcm_period, (unsigned long) pcm_buffer);
     return true;
 }
 
 static void I_ALSA_ShutdownSound(void)
 {
-    audio_thread_running = false;
-    pthread_join(audio_thread, NULL);
+    if (audio_thread_running) {
+        __atomic_store_n(&audio_thread_running, false, __ATOMIC_RELEASE);
+        pthread_join(audio_thread, NULL);
+
+        // Whatever the mixer didn't get to, such as freeing songs
+        run_commands();
+
+        printf("I_ALSA_ShutdownSound: %u mixer commands, at most %u queued, "
+               "%u dropped\n", cmd_stats.commands, cmd_stats.max_queued,
+               cmd_stats.dropped);
+
+        if (pcm_stats.wakeups > 0) {
+            printf("I_ALSA_ShutdownSound: %u underruns, latency %.1f ms average, "
+                   "%.1f ms max\n", pcm_stats.underruns,
+                   pcm_stats.latency_total * 1000.0 / pcm_stats.wakeups / mixer_rate,
+                   pcm_stats.latency_max * 1000.0 / mixer_rate);
+        }
 
-    for (int i = 0; i < NUM_CHANNELS; i++) {
-        if (channels[i].data) {
-            free(channels[i].data);
-            channels[i].data = NULL;
+        if (music_stalls > 0) {
+            printf("I_ALSA_ShutdownSound: music waited for rendering in %u periods\n",
+                   music_stalls);
         }
     }
 
+    if (sound_file != NULL) {
+        close_sound_file();
+    }
+
+    // The channels only point into the sound cache
+    memset(channels, 0, sizeof(channels));
+    stop_music();
+    free_sounds();
+
     if (pcm_handle) {
         snd_pcm_drain(pcm_handle);
         snd_pcm_close(pcm_handle);
@@ -281,57 +1190,92 @@ static int I_ALSA_GetSfxLumpNum(sfxinfo_t *sfxinfo)
 
 static void I_ALSA_UpdateSound(void)
 {
-    // empty
+    // Whatever the ring was too full for last time
+    send_pending();
+
+    if (sound_file != NULL) {
+        write_sound_file();
+    }
 }
 
 static void I_ALSA_UpdateSoundParams(int handle, int vol, int sep)
 {
     if (handle < 0 || handle >= NUM_CHANNELS) return;
-    channels[handle].volume = vol;
     // sep ignored for mono
+    send_or_keep(&(mixer_cmd_t) { .type = CMD_PARAMS, .channel = handle, .volume = vol },
+                 PENDING_PARAMS(handle));
+}
+
+static void I_ALSA_StopSound(int handle)
+{
+    if (handle < 0 || handle >= NUM_CHANNELS) return;
+    send_or_keep(&(mixer_cmd_t) { .type = CMD_STOP, .channel = handle }, PENDING_STOP(handle));
+    channel_stopped[handle] = true;
 }
 
 static int I_ALSA_StartSound(sfxinfo_t *sfxinfo, int channel, int vol, int sep)
 {
-    int lumpnum, lumplen;
-    byte *data;
+    alsa_sfx_t *snd;
 
     if (channel < 0 || channel >= NUM_CHANNELS) return -1;
 
-    if (channels[channel].data) {
-        channels[channel].active = false;
-    }
-
-    lumpnum = I_ALSA_GetSfxLumpNum(sfxinfo);
-    data = W_CacheLumpNum(lumpnum, PU_STATIC);
-    lumplen = W_LumpLength(lumpnum);
+    sfx_stats.starts++;
 
-    if (lumplen > 8) {
-        data += 8;
-        lumplen -= 8;
+    snd = cache_sound(sfxinfo, I_ALSA_GetSfxLumpNum(sfxinfo));
+    if (snd == NULL) {
+        I_ALSA_StopSound(channel);
+        return -1;
     }
 
-    channels[channel].data = convert_sound(data, lumplen);
-    if (!channels[channel].data) return -1;
+    if (!send_command(&(mixer_cmd_t) {
+        .type = CMD_START, .channel = channel, .volume = vol,
+        .serial = channel_serial[channel] + 1, .data = snd->samples, .length = snd->length,
+        .rate = snd->rate
+    })) {
+        return -1;
+    }
 
-    channels[channel].length = lumplen;
-    channels[channel].position = 0;
-    channels[channel].volume = vol;
-    channels[channel].active = true;
+    // Replaces whatever was still to be sent for the channel
+    pending[PENDING_STOP(channel)] = false;
+    pending[PENDING_PARAMS(channel)] = false;
+    channel_serial[channel]++;
+    channel_stopped[channel] = false;
 
     return channel;
 }
 
-static void I_ALSA_StopSound(int handle)
+static boolean I_ALSA_SoundIsPlaying(int handle)
 {
-    if (handle < 0 || handle >= NUM_CHANNELS) return;
-    channels[handle].active = false;
+    if (handle < 0 || handle >= NUM_CHANNELS) return false;
+    return !channel_stopped[handle]
+        && __atomic_load_n(&channel_done[handle], __ATOMIC_ACQUIRE) != channel_serial[handle];
 }
 
-static boolean I_ALSA_SoundIsPlaying(int handle)
+static void I_ALSA_PrecacheSounds(sfxinfo_t *sounds, int num_sounds)
 {
-    if (handle < 0 || handle >= NUM_CHANNELS) return false;
-    return channels[handle].active;
+    char namebuf[9];
+    int lumpnum;
+
+    //!
+    // Convert every sound effect at startup, rather than the first time
+    // each one is played.
+    //
+
+    if (!M_ParmExists("-precachesfx")) {
+        return;
+    }
+
+    for (int i = 0; i < num_sounds; i++) {
+        M_snprintf(namebuf, sizeof(namebuf), "ds%s", sounds[i].name);
+        lumpnum = W_CheckNumForName(namebuf);
+
+        if (lumpnum >= 0) {
+            cache_sound(&sounds[i], lumpnum);
+        }
+    }
+
+    printf("I_ALSA_PrecacheSounds: %u sound effects, %u KB\n",
+           sfx_stats.sounds, (unsigned int) (sfx_stats.used / 1024));
 }
 
 static snddevice_t sound_devices[] = { SNDDEVICE_SB };
@@ -347,7 +1291,7 @@ sound_module_t DG_sound_module = {
     I_ALSA_StartSound,
     I_ALSA_StopSound,
     I_ALSA_SoundIsPlaying,
-    NULL,
+    I_ALSA_PrecacheSounds,
 };
 
 int use_libsamplerate = 0;
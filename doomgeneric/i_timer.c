@@ -26,6 +26,25 @@
 //#include <sys/time.h>
 //#include <unistd.h>
 
+#ifdef EVENT_MAIN_LOOP
+
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "i_video.h"
+
+// With EVENT_MAIN_LOOP, I_WaitTic blocks in epoll_wait on a timerfd
+// armed for the tic deadline and on the platform's input descriptor,
+// instead of waking every millisecond to check the time.
+
+static int epoll_fd = -1;
+static int timer_fd = -1;
+static boolean event_loop_failed = false;
+
+#endif
+
 
 //
 // I_GetTime
@@ -81,6 +100,136 @@ void I_Sleep(int ms)
 	DG_SleepMs(ms);
 }
 
+#ifdef EVENT_MAIN_LOOP
+
+static boolean InitEventLoop(void)
+{
+    struct epoll_event ev;
+
+    if (epoll_fd >= 0)
+    {
+        return true;
+    }
+
+    if (event_loop_failed)
+    {
+        return false;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    ev.events = EPOLLIN;
+    ev.data.fd = timer_fd;
+
+    if (epoll_fd < 0 || timer_fd < 0
+     || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) < 0)
+    {
+        perror("I_InitTimer: falling back to polling");
+
+        if (epoll_fd >= 0)
+        {
+            close(epoll_fd);
+        }
+
+        if (timer_fd >= 0)
+        {
+            close(timer_fd);
+        }
+
+        epoll_fd = timer_fd = -1;
+        event_loop_failed = true;
+
+        return false;
+    }
+
+    return true;
+}
+
+#endif
+
+//
+// Wake I_WaitTic when fd becomes readable, so that input is read as
+// soon as it arrives rather than on the next tic.
+//
+
+void I_SetInputFd(int fd)
+{
+#ifdef EVENT_MAIN_LOOP
+    struct epoll_event ev;
+
+    if (fd < 0 || !InitEventLoop())
+    {
+        return;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        perror("I_SetInputFd");
+    }
+#endif
+}
+
+//
+// Wait until I_GetTime reaches tic. May return early when input is
+// waiting, callers check the time again.
+//
+
+void I_WaitTic(int tic)
+{
+#ifdef EVENT_MAIN_LOOP
+    struct itimerspec its = {{ 0, 0 }, { 0, 0 }};
+    struct epoll_event ev[4];
+    uint64_t expirations;
+    int64_t wait_us;
+    int i, n;
+
+    if (InitEventLoop())
+    {
+        // Microseconds from now until the first millisecond at which
+        // I_GetTime returns tic. Now is taken as the start of the
+        // current millisecond, so this can be late by up to 1ms but
+        // never early.
+
+        wait_us = (((int64_t) tic * 1000 + TICRATE - 1) / TICRATE
+                    - I_GetTimeMS()) * 1000;
+
+        if (wait_us <= 0)
+        {
+            return;
+        }
+
+        its.it_value.tv_sec = wait_us / 1000000;
+        its.it_value.tv_nsec = (wait_us % 1000000) * 1000;
+        timerfd_settime(timer_fd, 0, &its, NULL);
+
+        n = epoll_wait(epoll_fd, ev, 4, -1);
+
+        for (i = 0; i < n; ++i)
+        {
+            if (ev[i].data.fd == timer_fd)
+            {
+                read(timer_fd, &expirations, sizeof(expirations));
+            }
+            else
+            {
+                // Drain the input into the event queue now, it is
+                // level triggered and would wake us again otherwise.
+
+                I_StartTic();
+            }
+        }
+
+        return;
+    }
+#endif
+
+    I_Sleep(1);
+}
+
 void I_WaitVBL(int count)
 {
     //I_Sleep((count * 1000) / 70);
@@ -32,6 +32,12 @@ int I_GetTimeMS (void);
 // Pause for a specified number of ms
 void I_Sleep(int ms);
 
+// Wait for the given tic, or for input to arrive
+void I_WaitTic(int tic);
+
+// Descriptor I_WaitTic should also wake up for
+void I_SetInputFd(int fd);
+
 // Initialize timer
 void I_InitTimer(void);
 
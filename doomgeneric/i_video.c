@@ -89,6 +89,14 @@ static struct color colors[256];
 
 #endif  // CMAP256
 
+#ifdef SKIP_UNCHANGED_FRAMES
+
+// Copy of the last frame handed to DG_DrawFrame
+
+static byte *last_frame;
+static boolean last_frame_valid;
+
+#endif
 
 void I_GetEvent(void);
 
@@ -289,6 +297,10 @@ void I_InitGraphics (void)
     /* Allocate screen to draw to */
 	I_VideoBuffer = (byte*)Z_Malloc (SCREENWIDTH * SCREENHEIGHT, PU_STATIC, NULL);  // For DOOM to draw on
 
+#ifdef SKIP_UNCHANGED_FRAMES
+	last_frame = (byte*)Z_Malloc (SCREENWIDTH * SCREENHEIGHT, PU_STATIC, NULL);
+#endif
+
 	screenvisible = true;
 
     extern void I_InitInput(void);
@@ -324,6 +336,19 @@ void I_FinishUpdate (void)
     int x_offset, y_offset, x_offset_end;
     unsigned char *line_in, *line_out;
 
+#ifdef SKIP_UNCHANGED_FRAMES
+    // Nothing to present if neither the frame nor the palette has
+    // changed since the last one
+    if (last_frame_valid
+     && !memcmp(last_frame, I_VideoBuffer, SCREENWIDTH * SCREENHEIGHT))
+    {
+        return;
+    }
+
+    memcpy(last_frame, I_VideoBuffer, SCREENWIDTH * SCREENHEIGHT);
+    last_frame_valid = true;
+#endif
+
     /* Offsets in case FB is bigger than DOOM */
     /* 600 = s_Fb heigt, 200 screenheight */
     /* 600 = s_Fb heigt, 200 screenheight */
@@ -417,6 +442,12 @@ void I_SetPalette (byte* palette)
     palette_changed = true;
 
 #endif  // CMAP256
+
+#ifdef SKIP_UNCHANGED_FRAMES
+
+    last_frame_valid = false;
+
+#endif
 }
 
 // Given an RGB value, find the closest matching palette index.
@@ -22,10 +22,43 @@
 
 #include "doomtype.h"
 
-// Screen width and height.
+// Original screen width and height. Menus, the status bar and all
+// other patch graphics are laid out in this space.
 
-#define SCREENWIDTH  320
-#define SCREENHEIGHT 200
+#define ORIGWIDTH  320
+#define ORIGHEIGHT 200
+
+// Screen width and height. The 3D view is rendered at this size and
+// patch graphics are scaled to it, so a build can render at a lower
+// resolution with e.g. -DSCREENWIDTH=160 -DSCREENHEIGHT=100.
+
+#ifndef SCREENWIDTH
+#define SCREENWIDTH  ORIGWIDTH
+#endif
+
+#ifndef SCREENHEIGHT
+#define SCREENHEIGHT ORIGHEIGHT
+#endif
+
+// Convert between original 320x200 coordinates and screen pixels.
+
+#if SCREENWIDTH != ORIGWIDTH || SCREENHEIGHT != ORIGHEIGHT
+
+#define SCREEN_SCALED
+
+#define TOSCREENX(x)   (((x) * SCREENWIDTH + ORIGWIDTH - 1) / ORIGWIDTH)
+#define TOSCREENY(y)   (((y) * SCREENHEIGHT + ORIGHEIGHT - 1) / ORIGHEIGHT)
+#define FROMSCREENX(x) ((x) * ORIGWIDTH / SCREENWIDTH)
+#define FROMSCREENY(y) ((y) * ORIGHEIGHT / SCREENHEIGHT)
+
+#else
+
+#define TOSCREENX(x)   (x)
+#define TOSCREENY(y)   (y)
+#define FROMSCREENX(x) (x)
+#define FROMSCREENY(y) (y)
+
+#endif
 
 // Screen width used for "squash" scale functions
 
@@ -0,0 +1,521 @@
+//
+// Virtual SPI panel for running the Vector build on a dev box.
+//
+// Stands in for the sysfs GPIO files and /dev/spidev1.0. The D/C line
+// and the SPI messages are decoded like an ST7789/ST7735 would: CASET
+// and RASET set the write window, RAMWR/RAMWRC fill it with RGB565
+// pixels. Only the commands the Vector driver relies on are modelled.
+//
+// Per frame the bytes, SPI messages and commands sent are counted, and
+// the panel contents can be dumped to a PPM file or a shared memory
+// object after every frame.
+//
+
+#define LCD_SIM_INTERNAL
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <linux/spi/spidev.h>
+
+#include "doomtype.h"
+#include "m_argv.h"
+#include "lcd_sim.h"
+
+// Same pin as doomgeneric_vector.c; every other GPIO is a reset line
+#define SIM_GPIO_DC 110
+
+#define SIM_MAX_GPIOS 8
+
+typedef struct {
+    int fd;
+    int pin;
+} sim_gpio_t;
+
+static sim_gpio_t sim_gpios[SIM_MAX_GPIOS];
+static int sim_num_gpios = 0;
+
+static int sim_spi_fd = -1;
+static int sim_bufsiz = 4096;
+static boolean sim_started = false;
+
+// Controller state
+
+static int sim_dc = 0;
+static uint8_t sim_cmd = 0;
+static uint8_t sim_params[16];
+static int sim_num_params = 0;
+
+static int sim_xs = 0, sim_xe = LCD_SIM_RAM_WIDTH - 1;
+static int sim_ys = 0, sim_ye = LCD_SIM_RAM_HEIGHT - 1;
+static int sim_x = 0, sim_y = 0;
+static int sim_lsb_first = 0;
+static int sim_half_pixel = -1;
+
+static uint16_t sim_ram[LCD_SIM_RAM_WIDTH * LCD_SIM_RAM_HEIGHT];
+
+// Union of all RAMWR windows, taken as the visible area of the panel
+static int sim_area_x0 = LCD_SIM_RAM_WIDTH, sim_area_x1 = -1;
+static int sim_area_y0 = LCD_SIM_RAM_HEIGHT, sim_area_y1 = -1;
+
+typedef struct {
+    unsigned int bytes;
+    unsigned int messages;
+    unsigned int segments;
+    unsigned int commands;
+    unsigned int pixels;
+} sim_counts_t;
+
+static sim_counts_t sim_frame;
+static sim_counts_t sim_total;
+static sim_counts_t sim_max;
+static unsigned int sim_frames = 0;
+static unsigned int sim_errors = 0;
+static unsigned int sim_resets = 0;
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char* sim_dump_name = NULL;
+static FILE* sim_log = NULL;
+static lcd_sim_shm_t* sim_shm = NULL;
+
+static void sim_reset_controller() {
+    sim_cmd = 0;
+    sim_num_params = 0;
+    sim_xs = 0;
+    sim_xe = LCD_SIM_RAM_WIDTH - 1;
+    sim_ys = 0;
+    sim_ye = LCD_SIM_RAM_HEIGHT - 1;
+    sim_lsb_first = 0;
+    sim_half_pixel = -1;
+}
+
+static void sim_write_pixel(uint16_t pixel) {
+    if (sim_x < LCD_SIM_RAM_WIDTH && sim_y < LCD_SIM_RAM_HEIGHT) {
+        sim_ram[sim_y * LCD_SIM_RAM_WIDTH + sim_x] = pixel;
+    }
+
+    sim_frame.pixels++;
+
+    if (++sim_x > sim_xe) {
+        sim_x = sim_xs;
+        if (++sim_y > sim_ye) {
+            sim_y = sim_ys;
+        }
+    }
+}
+
+static void sim_command(uint8_t cmd) {
+    sim_cmd = cmd;
+    sim_num_params = 0;
+    sim_half_pixel = -1;
+    sim_frame.commands++;
+
+    switch (cmd) {
+        case 0x01:  // Software reset
+            sim_reset_controller();
+            break;
+
+        case 0x2C:  // Memory write
+            sim_x = sim_xs;
+            sim_y = sim_ys;
+            if (sim_xs < sim_area_x0) sim_area_x0 = sim_xs;
+            if (sim_xe > sim_area_x1) sim_area_x1 = sim_xe;
+            if (sim_ys < sim_area_y0) sim_area_y0 = sim_ys;
+            if (sim_ye > sim_area_y1) sim_area_y1 = sim_ye;
+            break;
+    }
+}
+
+static void sim_data(const uint8_t* data, int len) {
+    // Pixel data carries on across messages, even mid-pixel
+    if (sim_cmd == 0x2C || sim_cmd == 0x3C) {
+        for (int i = 0; i < len; i++) {
+            if (sim_half_pixel < 0) {
+                sim_half_pixel = data[i];
+                continue;
+            }
+
+            if (sim_lsb_first) {
+                sim_write_pixel(sim_half_pixel | (data[i] << 8));
+            } else {
+                sim_write_pixel((sim_half_pixel << 8) | data[i]);
+            }
+            sim_half_pixel = -1;
+        }
+        return;
+    }
+
+    for (int i = 0; i < len && sim_num_params < (int) sizeof(sim_params); i++) {
+        sim_params[sim_num_params++] = data[i];
+
+        switch (sim_cmd) {
+            case 0x2A:  // Column address set
+                if (sim_num_params == 4) {
+                    sim_xs = (sim_params[0] << 8) | sim_params[1];
+                    sim_xe = (sim_params[2] << 8) | sim_params[3];
+                }
+                break;
+
+            case 0x2B:  // Row address set
+                if (sim_num_params == 4) {
+                    sim_ys = (sim_params[0] << 8) | sim_params[1];
+                    sim_ye = (sim_params[2] << 8) | sim_params[3];
+                }
+                break;
+
+            case 0xB0:  // RAM control, ENDIAN bit
+                if (sim_num_params == 2) {
+                    sim_lsb_first = (sim_params[1] & 0x08) != 0;
+                }
+                break;
+        }
+    }
+}
+
+static void sim_transfer(const uint8_t* data, int len) {
+    if (sim_dc) {
+        sim_data(data, len);
+        return;
+    }
+
+    // A command byte followed by more bytes with D/C low is read by the
+    // panel as several commands
+    for (int i = 0; i < len; i++) {
+        sim_command(data[i]);
+    }
+}
+
+static void sim_dump_ppm() {
+    char name[256];
+    int width = sim_area_x1 - sim_area_x0 + 1;
+    int height = sim_area_y1 - sim_area_y0 + 1;
+
+    snprintf(name, sizeof(name), sim_dump_name, sim_frames);
+
+    FILE* f = fopen(name, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "LCD sim: can't write %s: %s\n", name, strerror(errno));
+        sim_dump_name = NULL;
+        return;
+    }
+
+    fprintf(f, "P6\n%d %d\n255\n", width, height);
+
+    for (int y = sim_area_y0; y <= sim_area_y1; y++) {
+        for (int x = sim_area_x0; x <= sim_area_x1; x++) {
+            uint16_t c = sim_ram[y * LCD_SIM_RAM_WIDTH + x];
+            uint8_t rgb[3] = {
+                ((c >> 11) & 0x1F) * 255 / 31,
+                ((c >> 5) & 0x3F) * 255 / 63,
+                (c & 0x1F) * 255 / 31
+            };
+            fwrite(rgb, 1, 3, f);
+        }
+    }
+
+    fclose(f);
+}
+
+static void sim_copy_shm() {
+    int width = sim_area_x1 - sim_area_x0 + 1;
+    int height = sim_area_y1 - sim_area_y0 + 1;
+
+    sim_shm->width = width;
+    sim_shm->height = height;
+
+    for (int y = 0; y < height; y++) {
+        memcpy(sim_shm->pixels + y * width,
+               sim_ram + (sim_area_y0 + y) * LCD_SIM_RAM_WIDTH + sim_area_x0,
+               width * sizeof(uint16_t));
+    }
+
+    __sync_synchronize();
+    sim_shm->frame = sim_frames;
+}
+
+static void sim_open_shm(const char* name) {
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(lcd_sim_shm_t)) < 0) {
+        fprintf(stderr, "LCD sim: can't create shared memory %s: %s\n", name, strerror(errno));
+        return;
+    }
+
+    sim_shm = mmap(NULL, sizeof(lcd_sim_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (sim_shm == MAP_FAILED) {
+        sim_shm = NULL;
+        return;
+    }
+
+    memset(sim_shm, 0, sizeof(lcd_sim_shm_t));
+    sim_shm->magic = LCD_SIM_SHM_MAGIC;
+    printf("LCD sim: panel exported to shared memory %s\n", name);
+}
+
+static void sim_print_stats() {
+    pthread_mutex_lock(&sim_lock);
+
+    unsigned int frames = sim_frames ? sim_frames : 1;
+
+    printf("LCD sim: %u frames, %.0f bytes/frame (max %u), %.1f messages/frame (max %u), "
+           "%.1f commands/frame, %.0f pixels/frame\n",
+           sim_frames,
+           (double) sim_total.bytes / frames, sim_max.bytes,
+           (double) sim_total.messages / frames, sim_max.messages,
+           (double) sim_total.commands / frames,
+           (double) sim_total.pixels / frames);
+
+    if (sim_errors || sim_resets != 1) {
+        printf("LCD sim: %u rejected messages, %u panel resets\n", sim_errors, sim_resets);
+    }
+
+    if (sim_log != NULL) {
+        fclose(sim_log);
+        sim_log = NULL;
+    }
+
+    pthread_mutex_unlock(&sim_lock);
+}
+
+static void sim_start() {
+    int p;
+
+    sim_started = true;
+
+    //!
+    // @arg <bytes>
+    //
+    // LCD simulator: size limit of one SPI message, as in the spidev
+    // bufsiz module parameter. Default is 4096.
+    //
+
+    p = M_CheckParmWithArgs("-lcdsimbufsiz", 1);
+    if (p > 0) {
+        sim_bufsiz = atoi(myargv[p + 1]);
+    }
+
+    //!
+    // @arg <file>
+    //
+    // LCD simulator: write the panel contents to a PPM file after every
+    // frame. A printf pattern such as frame%04d.ppm gives one file per
+    // frame.
+    //
+
+    p = M_CheckParmWithArgs("-lcdsimdump", 1);
+    if (p > 0) {
+        sim_dump_name = myargv[p + 1];
+    }
+
+    //!
+    // @arg <name>
+    //
+    // LCD simulator: keep a copy of the panel contents in the POSIX
+    // shared memory object <name>, e.g. /doomlcd.
+    //
+
+    p = M_CheckParmWithArgs("-lcdsimshm", 1);
+    if (p > 0) {
+        sim_open_shm(myargv[p + 1]);
+    }
+
+    //!
+    // @arg <file>
+    //
+    // LCD simulator: log bytes, SPI messages, commands and pixels sent
+    // for every frame as CSV.
+    //
+
+    p = M_CheckParmWithArgs("-lcdsimlog", 1);
+    if (p > 0) {
+        sim_log = fopen(myargv[p + 1], "w");
+        if (sim_log != NULL) {
+            setvbuf(sim_log, NULL, _IOLBF, 0);
+            fprintf(sim_log, "frame,bytes,messages,segments,commands,pixels\n");
+        }
+    }
+
+    // The panel is brought up off the main thread, so use atexit rather
+    // than I_AtExit, which isn't thread safe
+    atexit(sim_print_stats);
+
+    printf("LCD sim: simulated panel, %d byte SPI messages\n", sim_bufsiz);
+}
+
+static sim_gpio_t* sim_find_gpio(int fd) {
+    for (int i = 0; i < sim_num_gpios; i++) {
+        if (sim_gpios[i].fd == fd) {
+            return &sim_gpios[i];
+        }
+    }
+    return NULL;
+}
+
+int lcd_sim_open(const char* path, int flags, ...) {
+    int pin;
+    int fd;
+
+    if (!sim_started) {
+        sim_start();
+    }
+
+    // spidev's bufsiz parameter is read back through a pipe
+    if (!strcmp(path, "/sys/module/spidev/parameters/bufsiz")) {
+        int fds[2];
+        char buf[32];
+
+        if (pipe(fds) < 0) return -1;
+        snprintf(buf, sizeof(buf), "%d\n", sim_bufsiz);
+        write(fds[1], buf, strlen(buf));
+        close(fds[1]);
+        return fds[0];
+    }
+
+    if (!strcmp(path, "/dev/spidev1.0")) {
+        sim_spi_fd = open("/dev/null", O_RDWR);
+        return sim_spi_fd;
+    }
+
+    if (!strncmp(path, "/sys/class/gpio/", 16)) {
+        fd = open("/dev/null", O_RDWR);
+
+        if (fd >= 0 && sscanf(path, "/sys/class/gpio/gpio%d/value", &pin) == 1
+         && sim_num_gpios < SIM_MAX_GPIOS) {
+            sim_gpios[sim_num_gpios].fd = fd;
+            sim_gpios[sim_num_gpios].pin = pin;
+            sim_num_gpios++;
+        }
+
+        return fd;
+    }
+
+    if (flags & O_CREAT) {
+        va_list args;
+        va_start(args, flags);
+        mode_t mode = va_arg(args, int);
+        va_end(args);
+        return open(path, flags, mode);
+    }
+
+    return open(path, flags);
+}
+
+int lcd_sim_close(int fd) {
+    sim_gpio_t* gpio = sim_find_gpio(fd);
+
+    if (gpio != NULL) {
+        *gpio = sim_gpios[--sim_num_gpios];
+    }
+    if (fd == sim_spi_fd) {
+        sim_spi_fd = -1;
+    }
+
+    return close(fd);
+}
+
+ssize_t lcd_sim_pwrite(int fd, const void* buf, size_t count, off_t offset) {
+    sim_gpio_t* gpio = sim_find_gpio(fd);
+
+    if (gpio == NULL) {
+        return pwrite(fd, buf, count, offset);
+    }
+
+    int level = count > 0 && ((const char*) buf)[0] == '1';
+
+    if (gpio->pin == SIM_GPIO_DC) {
+        sim_dc = level;
+    } else if (level) {
+        // Reset released
+        sim_reset_controller();
+        sim_resets++;
+    }
+
+    return count;
+}
+
+int lcd_sim_ioctl(int fd, unsigned long request, void* arg) {
+    if (fd != sim_spi_fd) {
+        return ioctl(fd, request, arg);
+    }
+
+    if (request == SPI_IOC_RD_MODE) {
+        *(uint8_t*) arg = SPI_MODE_0;
+        return 0;
+    }
+
+    // SPI_IOC_MESSAGE(n) encodes n in the ioctl size field
+    if (_IOC_TYPE(request) != SPI_IOC_MAGIC || _IOC_NR(request) != 0
+     || _IOC_DIR(request) != _IOC_WRITE) {
+        errno = ENOTTY;
+        return -1;
+    }
+
+    const struct spi_ioc_transfer* xfer = arg;
+    int segments = _IOC_SIZE(request) / sizeof(struct spi_ioc_transfer);
+    unsigned int total = 0;
+
+    for (int i = 0; i < segments; i++) {
+        total += xfer[i].len;
+    }
+
+    // spidev rejects messages larger than its buffer
+    if (total > (unsigned int) sim_bufsiz) {
+        sim_errors++;
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    for (int i = 0; i < segments; i++) {
+        sim_transfer((const uint8_t*) (uintptr_t) xfer[i].tx_buf, xfer[i].len);
+    }
+
+    sim_frame.bytes += total;
+    sim_frame.messages++;
+    sim_frame.segments += segments;
+
+    return total;
+}
+
+void lcd_sim_end_frame(void) {
+    pthread_mutex_lock(&sim_lock);
+
+    sim_frames++;
+
+    sim_total.bytes += sim_frame.bytes;
+    sim_total.messages += sim_frame.messages;
+    sim_total.segments += sim_frame.segments;
+    sim_total.commands += sim_frame.commands;
+    sim_total.pixels += sim_frame.pixels;
+
+    if (sim_frame.bytes > sim_max.bytes) sim_max.bytes = sim_frame.bytes;
+    if (sim_frame.messages > sim_max.messages) sim_max.messages = sim_frame.messages;
+
+    if (sim_log != NULL) {
+        fprintf(sim_log, "%u,%u,%u,%u,%u,%u\n", sim_frames, sim_frame.bytes,
+                sim_frame.messages, sim_frame.segments, sim_frame.commands,
+                sim_frame.pixels);
+    }
+
+    pthread_mutex_unlock(&sim_lock);
+
+    memset(&sim_frame, 0, sizeof(sim_frame));
+
+    if (sim_area_x1 < 0) {
+        return;
+    }
+
+    if (sim_dump_name != NULL) {
+        sim_dump_ppm();
+    }
+    if (sim_shm != NULL) {
+        sim_copy_shm();
+    }
+}
@@ -0,0 +1,51 @@
+//
+// Virtual SPI panel for running the Vector build on a dev box.
+//
+// Built with -DLCD_SIM (make -f Makefile.vector SIM=1). The sysfs GPIO
+// and spidev accesses made by doomgeneric_vector.c are routed here, so
+// its panel code runs unchanged against a simulated display instead.
+//
+
+#ifndef LCD_SIM_H
+#define LCD_SIM_H
+
+#ifdef LCD_SIM
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// Layout of the -lcdsimshm shared memory object. frame is bumped after
+// each complete frame has been copied in.
+
+#define LCD_SIM_SHM_MAGIC 0x4d49534c  // "LSIM"
+#define LCD_SIM_RAM_WIDTH 320
+#define LCD_SIM_RAM_HEIGHT 320
+
+typedef struct {
+    uint32_t magic;
+    uint32_t width;
+    uint32_t height;
+    uint32_t frame;
+    uint16_t pixels[LCD_SIM_RAM_WIDTH * LCD_SIM_RAM_HEIGHT];  // RGB565
+} lcd_sim_shm_t;
+
+int lcd_sim_open(const char* path, int flags, ...);
+int lcd_sim_close(int fd);
+ssize_t lcd_sim_pwrite(int fd, const void* buf, size_t count, off_t offset);
+int lcd_sim_ioctl(int fd, unsigned long request, void* arg);
+
+// Called by the display worker once a frame has been pushed
+void lcd_sim_end_frame(void);
+
+#ifndef LCD_SIM_INTERNAL
+
+#define open lcd_sim_open
+#define close lcd_sim_close
+#define pwrite lcd_sim_pwrite
+#define ioctl lcd_sim_ioctl
+
+#endif
+
+#endif  // LCD_SIM
+
+#endif
@@ -109,6 +109,9 @@
 #define RATE_MASK ( ( 1 << RATE_SH ) - 1 )
 //Has to fit within 16bit lookuptable
 #define MUL_SH    16
+//MulTable goes on past ENV_LIMIT with zeros, up to the most a volume can be
+//with totalLevel, tremolo and ENV_MAX, so silent samples multiply out to 0
+#define MUL_TABLE_SIZE 2048
 
 //Check some ranges
 #if ENV_EXTRA > 3
@@ -212,7 +215,7 @@ static const Bit16u WaveStartTable[8] = {
 #endif
 
 #if ( DBOPL_WAVE == WAVE_TABLEMUL )
-static Bit16u MulTable[ 384 ];
+static Bit16u MulTable[ MUL_TABLE_SIZE ];
 #endif
 
 static Bit8u KslTable[ 8 * 16 ];
@@ -655,6 +658,102 @@ static inline Bits Operator__GetSample(Operator *self, Bits modulation ) {
   }
 }
 
+#if ( DBOPL_WAVE == WAVE_TABLEMUL )
+//The 2 operator modes are generated in blocks of up to this many samples,
+//each operator's envelope for the block first and then the waves
+#define BLOCK_SAMPLES 256
+
+//Volumes from i on while the envelope stays in its current state, attack
+//until it would reach ENV_MIN and the others limit. Stops before the
+//sample that would, so that one can go through TemplateVolume
+static Bit32u Operator__VolumeRun(Operator *self, Bit32u add, Bit32s limit,
+                                  Bit32u i, Bit32u samples, Bit32u* vol ) {
+  Bit32u level = self->currentLevel;
+  Bit32u rateIndex = self->rateIndex;
+  Bit32s volume = self->volume;
+  if ( self->state == ATTACK ) {
+    for ( ; i < samples; i++ ) {
+      Bit32u next = rateIndex + add;
+      Bit32s change = next >> RATE_SH;
+      Bit32s next_volume = volume + ( ( (~volume) * change ) >> 3 );
+      if ( next_volume < ENV_MIN )
+        break;
+      rateIndex = next & RATE_MASK;
+      volume = next_volume;
+      vol[ i ] = level + volume;
+    }
+  } else {
+    for ( ; i < samples; i++ ) {
+      Bit32u next = rateIndex + add;
+      Bit32s next_volume = volume + (Bit32s)( next >> RATE_SH );
+      if ( next_volume >= limit )
+        break;
+      rateIndex = next & RATE_MASK;
+      volume = next_volume;
+      vol[ i ] = level + volume;
+    }
+  }
+  self->rateIndex = rateIndex;
+  self->volume = volume;
+  return i;
+}
+
+//The volumes ForwardVolume would give for the next samples, a run of the
+//same state at a time. Where the envelope holds still it's filled in.
+//Returns whether any of them can be heard
+static int Operator__VolumeBlock(Operator *self, Bit32u samples, Bit32u* vol ) {
+  Bit32u audible = 0;
+  Bit32u i = 0;
+  while ( i < samples ) {
+    Bit8u state = self->state;
+    Bit32u add;
+    Bit32s limit;
+    switch ( state ) {
+    case ATTACK:
+      add = self->attackAdd;
+      limit = 0;
+      break;
+    case DECAY:
+      add = self->decayAdd;
+      limit = self->sustainLevel;
+      break;
+    case SUSTAIN:
+      add = ( self->reg20 & MASK_SUSTAIN ) ? 0 : self->releaseAdd;
+      limit = ENV_MAX;
+      break;
+    case RELEASE:
+      add = self->releaseAdd;
+      limit = ENV_MAX;
+      break;
+    default:
+      add = 0;
+      limit = 0;
+      break;
+    }
+    if ( add ) {
+      Bit32u start = i;
+      i = Operator__VolumeRun( self, add, limit, i, samples, vol );
+      //A run only goes one way, so its loudest is at one end
+      if ( i > start )
+        audible |= ( vol[ start ] < ENV_LIMIT ) | ( vol[ i - 1 ] < ENV_LIMIT );
+      if ( i == samples )
+        break;
+    }
+    //A sample that may move on to another state
+    vol[ i ] = self->currentLevel + Operator__TemplateVolume( self, state );
+    audible |= vol[ i ] < ENV_LIMIT;
+    i++;
+    //Else if it stays put, that's it for the block
+    if ( !add && self->state == state ) {
+      Bit32u held = vol[ i - 1 ];
+      for ( ; i < samples; i++ )
+        vol[ i ] = held;
+    }
+  }
+  return audible;
+}
+#endif
+
 static void Operator__Operator(Operator *self) {
   self->chanData = 0;
   self->freqMul = 0;
@@ -847,6 +946,252 @@ static void Channel__WriteC0(Channel *self, const Chip* chip, Bit8u val ) {
   }
 }
 
+#if ( DBOPL_WAVE == WAVE_TABLEMUL )
+//A 2 operator channel's part of a block: the volumes of both operators,
+//and what it adds to the output
+typedef struct {
+  Bit32u vol0[ BLOCK_SAMPLES ];
+  Bit32u vol1[ BLOCK_SAMPLES ];
+  Bit32s out[ BLOCK_SAMPLES ];
+  int audible0, audible1;
+  //The first operator modulates the second with fm, else is added to it
+  int fm;
+} ChannelBlock;
+
+//Silence check and Prepare for a 2 operator channel, the same as
+//BlockTemplate does them. FALSE when there's nothing to generate
+static int Channel__Start2Op(Channel *self, const Chip* chip, int fm ) {
+  if ( fm ? Operator__Silent( Channel__Op( self, 1 ) )
+          : Operator__Silent( Channel__Op( self, 0 ) ) && Operator__Silent( Channel__Op( self, 1 ) ) ) {
+    self->old[0] = self->old[1] = 0;
+    return FALSE;
+  }
+  Operator__Prepare( Channel__Op( self, 0 ), chip );
+  Operator__Prepare( Channel__Op( self, 1 ), chip );
+  return TRUE;
+}
+
+//The wave loop for both operators of a channel, as locals so two channels
+//can be worked together. The first operator feeds back on itself, so this
+//goes a sample at a time. MulTable being 0 past ENV_LIMIT stands in for
+//GetSample's silence check
+#define WAVE_2OP_START( _CH_, _BLOCK_ ) \
+  Operator *_CH_##op0 = Channel__Op( _CH_, 0 ); \
+  Operator *_CH_##op1 = Channel__Op( _CH_, 1 ); \
+  const Bit16s* _CH_##base0 = _CH_##op0->waveBase; \
+  const Bit16s* _CH_##base1 = _CH_##op1->waveBase; \
+  Bit32u _CH_##mask0 = _CH_##op0->waveMask; \
+  Bit32u _CH_##mask1 = _CH_##op1->waveMask; \
+  Bit32u _CH_##index0 = _CH_##op0->waveIndex; \
+  Bit32u _CH_##index1 = _CH_##op1->waveIndex; \
+  Bit32u _CH_##add0 = _CH_##op0->waveCurrent; \
+  Bit32u _CH_##add1 = _CH_##op1->waveCurrent; \
+  Bit32s _CH_##modMask = ( _BLOCK_ )->fm ? -1 : 0; \
+  Bit32s _CH_##old0 = _CH_->old[0]; \
+  Bit32s _CH_##old1 = _CH_->old[1]; \
+  Bit8u _CH_##feedback = _CH_->feedback
+
+//Do unsigned shift so we can shift out all bits but still stay in 10 bit range otherwise
+#define WAVE_2OP_SAMPLE( _CH_, _BLOCK_, _I_ ) \
+  do { \
+    Bit32s mod = (Bit32u)( _CH_##old0 + _CH_##old1 ) >> _CH_##feedback; \
+    _CH_##index0 += _CH_##add0; \
+    _CH_##index1 += _CH_##add1; \
+    _CH_##old0 = _CH_##old1; \
+    _CH_##old1 = ( _CH_##base0[ ( ( _CH_##index0 >> WAVE_SH ) + mod ) & _CH_##mask0 ] \
+                   * MulTable[ ( _BLOCK_ )->vol0[ _I_ ] ] ) >> MUL_SH; \
+    ( _BLOCK_ )->out[ _I_ ] = ( ( _CH_##base1[ ( ( _CH_##index1 >> WAVE_SH ) + ( _CH_##old0 & _CH_##modMask ) ) & _CH_##mask1 ] \
+                                  * MulTable[ ( _BLOCK_ )->vol1[ _I_ ] ] ) >> MUL_SH ) \
+                              + ( _CH_##old0 & ~_CH_##modMask ); \
+  } while ( 0 )
+
+#define WAVE_2OP_END( _CH_ ) \
+  do { \
+    _CH_##op0->waveIndex = _CH_##index0; \
+    _CH_##op1->waveIndex = _CH_##index1; \
+    _CH_->old[0] = _CH_##old0; \
+    _CH_->old[1] = _CH_##old1; \
+  } while ( 0 )
+
+static void Channel__WaveBlock(Channel *self, ChannelBlock* block, Bit32u samples ) {
+  Bit32u i;
+  WAVE_2OP_START( self, block );
+  for ( i = 0; i < samples; i++ )
+    WAVE_2OP_SAMPLE( self, block, i );
+  WAVE_2OP_END( self );
+}
+
+//Two channels at once, so one's feedback can be worked out while the
+//other's is still waiting on its lookups
+static void Channel__WaveBlockPair(Channel *a, ChannelBlock* blockA,
+                                   Channel *b, ChannelBlock* blockB, Bit32u samples ) {
+  Bit32u i;
+  WAVE_2OP_START( a, blockA );
+  WAVE_2OP_START( b, blockB );
+  for ( i = 0; i < samples; i++ ) {
+    WAVE_2OP_SAMPLE( a, blockA, i );
+    WAVE_2OP_SAMPLE( b, blockB, i );
+  }
+  WAVE_2OP_END( a );
+  WAVE_2OP_END( b );
+}
+
+//The first operator silent throughout only ever gives 0, so the second
+//no longer has to wait on it
+static void Channel__WaveBlockCarrier(Channel *self, ChannelBlock* block, Bit32u samples ) {
+  Operator *op0 = Channel__Op( self, 0 );
+  Operator *op1 = Channel__Op( self, 1 );
+  const Bit16s* base1 = op1->waveBase;
+  Bit32u mask1 = op1->waveMask;
+  Bit32u index1 = op1->waveIndex;
+  Bit32u add1 = op1->waveCurrent;
+  Bit32u i;
+  //The first sample still gets its output from before the block
+  index1 += add1;
+  if ( block->fm ) {
+    block->out[ 0 ] = ( base1[ ( ( index1 >> WAVE_SH ) + self->old[1] ) & mask1 ] * MulTable[ block->vol1[ 0 ] ] ) >> MUL_SH;
+  } else {
+    block->out[ 0 ] = ( ( base1[ ( index1 >> WAVE_SH ) & mask1 ] * MulTable[ block->vol1[ 0 ] ] ) >> MUL_SH ) + self->old[1];
+  }
+  for ( i = 1; i < samples; i++ ) {
+    index1 += add1;
+    block->out[ i ] = ( base1[ ( index1 >> WAVE_SH ) & mask1 ] * MulTable[ block->vol1[ i ] ] ) >> MUL_SH;
+  }
+  op1->waveIndex = index1;
+  op0->waveIndex += op0->waveCurrent * samples;
+  self->old[0] = samples > 1 ? 0 : self->old[1];
+  self->old[1] = 0;
+}
+
+//The second operator silent throughout leaves the first's own output,
+//which only matters for AM
+static void Channel__WaveBlockModulator(Channel *self, ChannelBlock* block, Bit32u samples ) {
+  Operator *op0 = Channel__Op( self, 0 );
+  Operator *op1 = Channel__Op( self, 1 );
+  const Bit16s* base0 = op0->waveBase;
+  Bit32u mask0 = op0->waveMask;
+  Bit32u index0 = op0->waveIndex;
+  Bit32u add0 = op0->waveCurrent;
+  Bit32s old0 = self->old[0];
+  Bit32s old1 = self->old[1];
+  Bit8u feedback = self->feedback;
+  Bit32u i;
+  for ( i = 0; i < samples; i++ ) {
+    Bit32s mod = (Bit32u)( old0 + old1 ) >> feedback;
+    index0 += add0;
+    old0 = old1;
+    old1 = ( base0[ ( ( index0 >> WAVE_SH ) + mod ) & mask0 ] * MulTable[ block->vol0[ i ] ] ) >> MUL_SH;
+    block->out[ i ] = old0;
+  }
+  op0->waveIndex = index0;
+  op1->waveIndex += op1->waveCurrent * samples;
+  self->old[0] = old0;
+  self->old[1] = old1;
+}
+
+//Envelopes for the next samples of a channel
+static void Channel__VolumeBlock(Channel *self, ChannelBlock* block, Bit32u samples ) {
+  block->audible0 = Operator__VolumeBlock( Channel__Op( self, 0 ), samples, block->vol0 );
+  block->audible1 = Operator__VolumeBlock( Channel__Op( self, 1 ), samples, block->vol1 );
+}
+
+//Waves for a channel on its own, using the cheaper loops when an operator
+//is silent. FALSE if there's nothing to mix in
+static int Channel__WaveBlockSingle(Channel *self, ChannelBlock* block, Bit32u samples ) {
+  if ( !block->audible0 ) {
+    Channel__WaveBlockCarrier( self, block, samples );
+  } else if ( !block->audible1 ) {
+    Channel__WaveBlockModulator( self, block, samples );
+    return !block->fm;
+  } else {
+    Channel__WaveBlock( self, block, samples );
+  }
+  return TRUE;
+}
+
+//Add a channel's output in, panned for opl3
+static void Channel__MixBlock(Channel *self, const ChannelBlock* block, Bit32u samples,
+                              Bit32s* output, int stereo ) {
+  Bit32u i;
+  if ( stereo ) {
+    for ( i = 0; i < samples; i++ ) {
+      output[ i * 2 + 0 ] += block->out[ i ] & self->maskLeft;
+      output[ i * 2 + 1 ] += block->out[ i ] & self->maskRight;
+    }
+  } else {
+    for ( i = 0; i < samples; i++ )
+      output[ i ] += block->out[ i ];
+  }
+}
+
+//sm2AM, sm2FM and the opl3 sm3AM, sm3FM a block at a time: envelopes for
+//each operator, then the waves, then the mix into output
+static void Channel__Block2Op(Channel *self, Bit32u samples, Bit32s* output,
+                              SynthMode mode ) {
+  ChannelBlock block;
+  int stereo = mode == sm3AM || mode == sm3FM;
+  block.fm = mode == sm2FM || mode == sm3FM;
+  while ( samples > 0 ) {
+    Bit32u count = samples < BLOCK_SAMPLES ? samples : BLOCK_SAMPLES;
+    Channel__VolumeBlock( self, &block, count );
+    if ( Channel__WaveBlockSingle( self, &block, count ) )
+      Channel__MixBlock( self, &block, count, output, stereo );
+    output += stereo ? count * 2 : count;
+    samples -= count;
+  }
+}
+
+//Two neighbouring opl2 channels in sm2AM or sm2FM, worked together where
+//both have both operators going
+static void Channel__Block2OpPair(Channel *a, Channel *b, Bit32u samples,
+                                  Bit32s* output ) {
+  ChannelBlock blockA, blockB;
+  blockA.fm = a->synthHandler == Channel__BlockTemplate_sm2FM;
+  blockB.fm = b->synthHandler == Channel__BlockTemplate_sm2FM;
+  while ( samples > 0 ) {
+    Bit32u count = samples < BLOCK_SAMPLES ? samples : BLOCK_SAMPLES;
+    Bit32u i;
+    Channel__VolumeBlock( a, &blockA, count );
+    Channel__VolumeBlock( b, &blockB, count );
+    if ( blockA.audible0 && blockA.audible1 && blockB.audible0 && blockB.audible1 ) {
+      Channel__WaveBlockPair( a, &blockA, b, &blockB, count );
+      for ( i = 0; i < count; i++ )
+        output[ i ] += blockA.out[ i ] + blockB.out[ i ];
+    } else {
+      if ( Channel__WaveBlockSingle( a, &blockA, count ) )
+        Channel__MixBlock( a, &blockA, count, output, FALSE );
+      if ( Channel__WaveBlockSingle( b, &blockB, count ) )
+        Channel__MixBlock( b, &blockB, count, output, FALSE );
+    }
+    output += count;
+    samples -= count;
+  }
+}
+
+static inline int Channel__Is2Op(const Channel *self) {
+  return self->synthHandler == Channel__BlockTemplate_sm2AM
+      || self->synthHandler == Channel__BlockTemplate_sm2FM;
+}
+
+//Generate for a channel and the one after it, if both are regular opl2 ones
+static Channel* Channel__BlockPair(Channel *self, Chip* chip, Bit32u samples,
+                                   Bit32s* output ) {
+  Channel *next = self + 1;
+  int live = Channel__Start2Op( self, chip, self->synthHandler == Channel__BlockTemplate_sm2FM );
+  int liveNext = Channel__Start2Op( next, chip, next->synthHandler == Channel__BlockTemplate_sm2FM );
+  if ( live && liveNext ) {
+    Channel__Block2OpPair( self, next, samples, output );
+  } else if ( live ) {
+    Channel__Block2Op( self, samples, output,
+                       self->synthHandler == Channel__BlockTemplate_sm2FM ? sm2FM : sm2AM );
+  } else if ( liveNext ) {
+    Channel__Block2Op( next, samples, output,
+                       next->synthHandler == Channel__BlockTemplate_sm2FM ? sm2FM : sm2AM );
+  }
+  return next + 1;
+}
+#endif
+
 static void Channel__ResetC0(Channel *self, const Chip* chip ) {
   Bit8u val = self->regC0;
   self->regC0 ^= 0xff;
@@ -913,6 +1258,13 @@ Channel* Channel__BlockTemplate(Channel *self, Chip* chip,
                                 SynthMode mode ) {
         Bitu i;
 
+#if ( DBOPL_WAVE == WAVE_TABLEMUL )
+  if ( mode == sm2AM || mode == sm2FM || mode == sm3AM || mode == sm3FM ) {
+    if ( Channel__Start2Op( self, chip, mode == sm2FM || mode == sm3FM ) )
+      Channel__Block2Op( self, samples, output, mode );
+    return( self + 1 );
+  }
+#endif
   switch( mode ) {
   case sm2AM:
   case sm3AM:
@@ -1277,6 +1629,12 @@ void Chip__GenerateBlock2(Chip *self, Bitu total, Bit32s* output ) {
     count = 0;
     for ( ch = self->chan; ch < self->chan + 9; ) {
       count++;
+#if ( DBOPL_WAVE == WAVE_TABLEMUL )
+      if ( ch + 1 < self->chan + 9 && Channel__Is2Op( ch ) && Channel__Is2Op( ch + 1 ) ) {
+        ch = Channel__BlockPair( ch, self, samples, output );
+        continue;
+      }
+#endif
       ch = (ch->synthHandler)( ch, self, samples, output );
     }
     total -= samples;
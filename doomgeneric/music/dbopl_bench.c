@@ -0,0 +1,205 @@
+//
+// Times the OPL emulator on its own, for comparing dbopl.c changes on
+// the host and on the robot.
+//
+// make -f Makefile.vector dbopl-bench
+// ./dbopl-bench [-rate <hz>] [-seconds <s>] [-runs <n>]
+//
+// A fixed register-write trace is built up front from a seeded
+// generator: instruments on all nine channels with every waveform,
+// feedback, AM/FM, tremolo and vibrato, and notes starting and
+// stopping. Rhythm mode is left off, as the OPL player never sets it.
+// The trace is then replayed a few times and the best run reported in
+// samples per second. The checksum of the output only depends on the
+// trace and the rate, so a faster emulator has to print the same one.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dbopl.h"
+
+#define RENDER 0xffff           // trace entry that renders value samples
+
+typedef struct {
+    unsigned short reg;
+    unsigned short value;
+} trace_event_t;
+
+static trace_event_t* trace;
+static size_t trace_len, trace_size;
+
+static uint32_t seed = 0x1d872b41;
+
+static unsigned int random_int(unsigned int range) {
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) % range;
+}
+
+static void add_event(unsigned int reg, unsigned int value) {
+    if (trace_len == trace_size) {
+        trace_size = trace_size ? trace_size * 2 : 4096;
+        trace = realloc(trace, trace_size * sizeof(*trace));
+        if (trace == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+
+    trace[trace_len].reg = reg;
+    trace[trace_len].value = value;
+    trace_len++;
+}
+
+// Registers of the two operators of a channel, as OPL2 lays them out
+static const int op_offsets[9] = {
+    0x00, 0x01, 0x02, 0x08, 0x09, 0x0a, 0x10, 0x11, 0x12
+};
+
+static void add_instrument(int channel) {
+    for (int op = 0; op < 2; op++) {
+        int reg = op_offsets[channel] + op * 3;
+        // The carrier is kept louder than the modulator, like real patches
+        int level = op ? random_int(24) : random_int(64);
+
+        add_event(0x20 + reg, random_int(256));
+        add_event(0x40 + reg, (random_int(4) << 6) | level);
+        add_event(0x60 + reg, ((8 + random_int(8)) << 4) | random_int(16));
+        add_event(0x80 + reg, random_int(256));
+        add_event(0xe0 + reg, random_int(4));
+    }
+
+    add_event(0xc0 + channel, random_int(16));
+}
+
+static void build_trace(unsigned int rate, unsigned int seconds) {
+    unsigned int total = rate * seconds;
+    unsigned int done = 0;
+    int notes[9] = { 0 };
+
+    add_event(0x01, 0x20);      // waveform select enable
+
+    for (int channel = 0; channel < 9; channel++) {
+        add_instrument(channel);
+    }
+
+    while (done < total) {
+        int channel = random_int(9);
+        unsigned int samples;
+
+        // Tremolo and vibrato depth
+        if (random_int(16) == 0) {
+            add_event(0xbd, random_int(4) << 6);
+        }
+
+        if (random_int(8) == 0) {
+            add_instrument(channel);
+        }
+
+        if (notes[channel] && random_int(3) == 0) {
+            add_event(0xb0 + channel, notes[channel] & 0x1f);
+            notes[channel] = 0;
+        } else {
+            int freq = 0x100 + random_int(0x300);
+            int block = random_int(8);
+
+            notes[channel] = (block << 2) | (freq >> 8);
+            add_event(0xa0 + channel, freq & 0xff);
+            add_event(0xb0 + channel, 0x20 | notes[channel]);
+        }
+
+        samples = 1 + random_int(rate / 20);
+        if (samples > total - done) {
+            samples = total - done;
+        }
+        add_event(RENDER, samples);
+        done += samples;
+    }
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Replay the trace on a fresh chip, returning the output's checksum
+static uint32_t render(unsigned int rate, Bit32s* buffer) {
+    static Chip chip;
+    uint32_t h = 2166136261u;   // FNV-1a over the samples
+
+    memset(&chip, 0, sizeof(chip));
+    Chip__Chip(&chip);
+    Chip__Setup(&chip, rate);
+
+    for (size_t i = 0; i < trace_len; i++) {
+        if (trace[i].reg != RENDER) {
+            Chip__WriteReg(&chip, trace[i].reg, trace[i].value);
+            continue;
+        }
+
+        Chip__GenerateBlock2(&chip, trace[i].value, buffer);
+
+        for (unsigned int j = 0; j < trace[i].value; j++) {
+            h = (h ^ (uint32_t) buffer[j]) * 16777619u;
+        }
+    }
+
+    return h;
+}
+
+int main(int argc, char* argv[]) {
+    unsigned int rate = 22050;
+    unsigned int seconds = 60;
+    int runs = 5;
+    Bit32s* buffer;
+    uint32_t sum = 0;
+    double best = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-rate") && i + 1 < argc) rate = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-seconds") && i + 1 < argc) seconds = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-runs") && i + 1 < argc) runs = atoi(argv[++i]);
+        else {
+            fprintf(stderr, "Usage: %s [-rate <hz>] [-seconds <s>] [-runs <n>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (rate < 1000 || seconds < 1 || runs < 1) {
+        fprintf(stderr, "Bad rate, length or number of runs\n");
+        return 1;
+    }
+
+    build_trace(rate, seconds);
+    buffer = malloc(rate / 20 * sizeof(*buffer));
+    DBOPL_InitTables();
+
+    printf("dbopl-bench: %u s at %u Hz, %zu trace entries\n", seconds, rate, trace_len);
+
+    for (int run = 0; run < runs; run++) {
+        double start = now_ms();
+        uint32_t h = render(rate, buffer);
+        double ms = now_ms() - start;
+
+        if (run > 0 && h != sum) {
+            fprintf(stderr, "Run %d gave checksum %08x, not %08x\n", run, h, sum);
+            return 1;
+        }
+        sum = h;
+
+        if (run == 0 || ms < best) {
+            best = ms;
+        }
+    }
+
+    printf("dbopl-bench: checksum %08x, best of %d: %.1f ms, %.0f samples/sec, %.0fx real time\n",
+           sum, runs, best, rate * (double) seconds / (best / 1000.0),
+           seconds * 1000.0 / best);
+
+    free(buffer);
+    free(trace);
+    return 0;
+}
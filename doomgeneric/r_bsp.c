@@ -16,6 +16,8 @@
 //	BSP traversal, handling of LineSegs for rendering.
 //
 
+#include <stdlib.h>
+
 
 
 
@@ -43,8 +45,10 @@ line_t*		linedef;
 sector_t*	frontsector;
 sector_t*	backsector;
 
-drawseg_t	drawsegs[MAXDRAWSEGS];
+// MAXDRAWSEGS of them, or more with -nolimits
+drawseg_t*	drawsegs;
 drawseg_t*	ds_p;
+int		numdrawsegs;
 
 
 void
@@ -55,6 +59,38 @@ R_StoreWallRange
 
 
 
+//
+// R_InitDrawSegs
+//
+void R_InitDrawSegs (void)
+{
+    numdrawsegs = MAXDRAWSEGS;
+    drawsegs = malloc (numdrawsegs * sizeof(*drawsegs));
+
+    if (!drawsegs)
+	I_Error ("R_InitDrawSegs: couldn't allocate drawsegs");
+}
+
+
+//
+// R_GrowDrawSegs
+// With ds_p at the end of drawsegs, doubles them.
+// Nothing points into them until R_DrawMasked.
+//
+void R_GrowDrawSegs (void)
+{
+    drawsegs = realloc (drawsegs, numdrawsegs * 2 * sizeof(*drawsegs));
+
+    if (!drawsegs)
+	I_Error ("R_GrowDrawSegs: couldn't allocate %i drawsegs",
+		 numdrawsegs * 2);
+
+    ds_p = drawsegs + numdrawsegs;
+    numdrawsegs *= 2;
+}
+
+
+
 //
 // R_ClearDrawSegs
 //
@@ -39,8 +39,9 @@ extern boolean		markceiling;
 
 extern boolean		skymap;
 
-extern drawseg_t	drawsegs[MAXDRAWSEGS];
+extern drawseg_t*	drawsegs;
 extern drawseg_t*	ds_p;
+extern int		numdrawsegs;
 
 extern lighttable_t**	hscalelight;
 extern lighttable_t**	vscalelight;
@@ -52,6 +53,8 @@ typedef void (*drawfunc_t) (int start, int stop);
 
 // BSP?
 void R_ClearClipSegs (void);
+void R_InitDrawSegs (void);
+void R_GrowDrawSegs (void);
 void R_ClearDrawSegs (void);
 
 
@@ -427,6 +427,9 @@ typedef struct
   int			lightlevel;
   int			minx;
   int			maxx;
+
+  // next in its R_FindPlane hash chain, -1 at the end
+  int			next;
   
   // leave pads for [minx-1]/[maxx+1]
   
@@ -21,10 +21,15 @@
 
 
 
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
 #include "doomdef.h"
 #include "deh_main.h"
 
 #include "i_system.h"
+#include "m_argv.h"
 #include "z_zone.h"
 #include "w_wad.h"
 
@@ -42,7 +47,7 @@
 #define MAXHEIGHT			832
 
 // status bar height at bottom of screen
-#define SBARHEIGHT		32
+#define SBARHEIGHT		TOSCREENY(32)
 
 //
 // All drawing to the view buffer is accomplished in this file.
@@ -79,15 +84,15 @@ static byte *background_buffer = NULL;
 // R_DrawColumn
 // Source is the top of the column to scale.
 //
-lighttable_t*		dc_colormap; 
-int			dc_x; 
-int			dc_yl; 
-int			dc_yh; 
-fixed_t			dc_iscale; 
-fixed_t			dc_texturemid;
+R_THREADLOCAL lighttable_t*	dc_colormap; 
+R_THREADLOCAL int		dc_x; 
+R_THREADLOCAL int		dc_yl; 
+R_THREADLOCAL int		dc_yh; 
+R_THREADLOCAL fixed_t		dc_iscale; 
+R_THREADLOCAL fixed_t		dc_texturemid;
 
 // first pixel in a column (possibly virtual) 
-byte*			dc_source;		
+R_THREADLOCAL byte*		dc_source;		
 
 // just for profiling 
 int			dccount;
@@ -146,52 +151,53 @@ void R_DrawColumn (void)
 
 
 
-// UNUSED.
-// Loop unrolled.
-#if 0
-void R_DrawColumn (void) 
+//
+// R_DrawColumnUnrolled
+// Loop unrolled. The texture index is kept in the top bits of
+//  frac, so (frac>>FRACBITS)&127 is just a shift.
+//
+static void R_DrawColumnUnrolled (void) 
 { 
     int			count; 
     byte*		source;
     byte*		dest;
-    byte*		colormap;
+    lighttable_t*	colormap;
     
-    unsigned		frac;
-    unsigned		fracstep;
-    unsigned		fracstep2;
-    unsigned		fracstep3;
-    unsigned		fracstep4;	 
+    unsigned int	frac;
+    unsigned int	fracstep;
  
     count = dc_yh - dc_yl + 1; 
 
+    if (count <= 0) 
+	return; 
+
+#ifdef RANGECHECK 
+    if ((unsigned)dc_x >= SCREENWIDTH
+	|| dc_yl < 0
+	|| dc_yh >= SCREENHEIGHT) 
+	I_Error ("R_DrawColumn: %i to %i at %i", dc_yl, dc_yh, dc_x); 
+#endif 
+
     source = dc_source;
     colormap = dc_colormap;		 
     dest = ylookup[dc_yl] + columnofs[dc_x];  
 	 
-    fracstep = dc_iscale<<9; 
-    frac = (dc_texturemid + (dc_yl-centery)*dc_iscale)<<9; 
- 
-    fracstep2 = fracstep+fracstep;
-    fracstep3 = fracstep2+fracstep;
-    fracstep4 = fracstep3+fracstep;
+    fracstep = (unsigned int) dc_iscale << 9; 
+    frac = (unsigned int) (dc_texturemid + (dc_yl-centery)*dc_iscale) << 9; 
 	
-    while (count >= 8) 
+    while (count >= 4) 
     { 
 	dest[0] = colormap[source[frac>>25]]; 
-	dest[SCREENWIDTH] = colormap[source[(frac+fracstep)>>25]]; 
-	dest[SCREENWIDTH*2] = colormap[source[(frac+fracstep2)>>25]]; 
-	dest[SCREENWIDTH*3] = colormap[source[(frac+fracstep3)>>25]];
-	
-	frac += fracstep4; 
-
-	dest[SCREENWIDTH*4] = colormap[source[frac>>25]]; 
-	dest[SCREENWIDTH*5] = colormap[source[(frac+fracstep)>>25]]; 
-	dest[SCREENWIDTH*6] = colormap[source[(frac+fracstep2)>>25]]; 
-	dest[SCREENWIDTH*7] = colormap[source[(frac+fracstep3)>>25]]; 
+	frac += fracstep; 
+	dest[SCREENWIDTH] = colormap[source[frac>>25]]; 
+	frac += fracstep; 
+	dest[SCREENWIDTH*2] = colormap[source[frac>>25]]; 
+	frac += fracstep; 
+	dest[SCREENWIDTH*3] = colormap[source[frac>>25]];
+	frac += fracstep; 
 
-	frac += fracstep4; 
-	dest += SCREENWIDTH*8; 
-	count -= 8;
+	dest += SCREENWIDTH*4; 
+	count -= 4;
     } 
 	
     while (count > 0)
@@ -202,7 +208,6 @@ void R_DrawColumn (void)
 	count--;
     } 
 }
-#endif
 
 
 void R_DrawColumnLow (void) 
@@ -269,7 +274,7 @@ int	fuzzoffset[FUZZTABLE] =
     FUZZOFF,FUZZOFF,-FUZZOFF,FUZZOFF,FUZZOFF,-FUZZOFF,FUZZOFF 
 }; 
 
-int	fuzzpos = 0; 
+R_THREADLOCAL int	fuzzpos = 0; 
 
 
 //
@@ -337,6 +342,81 @@ void R_DrawFuzzColumn (void)
     } while (count--); 
 } 
 
+//
+// R_SkipFuzzColumn
+// Moves fuzzpos on as far as drawing the column would,
+//  in either detail.
+//
+void R_SkipFuzzColumn (void)
+{
+    int		yl = dc_yl ? dc_yl : 1;
+    int		yh = dc_yh == viewheight-1 ? viewheight-2 : dc_yh;
+
+    if (yh >= yl)
+	fuzzpos = (fuzzpos + yh - yl + 1) % FUZZTABLE;
+}
+
+//
+// R_DrawFuzzColumnUnrolled
+// Each pixel may read the one just drawn above it, so this
+//  cannot be done more than a pixel at a time. But the pattern
+//  only needs wrapping once per pass through the table.
+//
+static void R_DrawFuzzColumnUnrolled (void) 
+{ 
+    int			count; 
+    int			run;
+    int*		offset;
+    byte*		dest; 
+    lighttable_t*	fuzzmap;
+
+    // Adjust borders. Low... 
+    if (!dc_yl) 
+	dc_yl = 1;
+
+    // .. and high.
+    if (dc_yh == viewheight-1) 
+	dc_yh = viewheight - 2; 
+		 
+    count = dc_yh - dc_yl + 1; 
+
+    // Zero length.
+    if (count <= 0) 
+	return; 
+
+#ifdef RANGECHECK 
+    if ((unsigned)dc_x >= SCREENWIDTH
+	|| dc_yl < 0 || dc_yh >= SCREENHEIGHT)
+    {
+	I_Error ("R_DrawFuzzColumn: %i to %i at %i",
+		 dc_yl, dc_yh, dc_x);
+    }
+#endif
+    
+    dest = ylookup[dc_yl] + columnofs[dc_x];
+    fuzzmap = colormaps + 6*256;
+
+    while (count > 0)
+    {
+	run = FUZZTABLE - fuzzpos;
+	if (run > count)
+	    run = count;
+
+	offset = fuzzoffset + fuzzpos;
+	fuzzpos += run;
+	count -= run;
+
+	while (run--)
+	{
+	    *dest = fuzzmap[dest[*offset++]]; 
+	    dest += SCREENWIDTH;
+	}
+
+	if (fuzzpos == FUZZTABLE) 
+	    fuzzpos = 0;
+    }
+} 
+
 // low detail mode version
  
 void R_DrawFuzzColumnLow (void) 
@@ -418,7 +498,7 @@ void R_DrawFuzzColumnLow (void)
 //  of the BaronOfHell, the HellKnight, uses
 //  identical sprites, kinda brightened up.
 //
-byte*	dc_translation;
+R_THREADLOCAL byte*	dc_translation;
 byte*	translationtables;
 
 void R_DrawTranslatedColumn (void) 
@@ -465,6 +545,67 @@ void R_DrawTranslatedColumn (void)
     } while (count--); 
 } 
 
+//
+// R_DrawTranslatedColumnUnrolled
+// Loop unrolled.
+//
+static void R_DrawTranslatedColumnUnrolled (void) 
+{ 
+    int			count; 
+    byte*		source;
+    byte*		translation;
+    lighttable_t*	colormap;
+    byte*		dest; 
+    fixed_t		frac;
+    fixed_t		fracstep;	 
+ 
+    count = dc_yh - dc_yl + 1; 
+    if (count <= 0) 
+	return; 
+				 
+#ifdef RANGECHECK 
+    if ((unsigned)dc_x >= SCREENWIDTH
+	|| dc_yl < 0
+	|| dc_yh >= SCREENHEIGHT)
+    {
+	I_Error ( "R_DrawColumn: %i to %i at %i",
+		  dc_yl, dc_yh, dc_x);
+    }
+#endif 
+
+    source = dc_source;
+    translation = dc_translation;
+    colormap = dc_colormap;
+    dest = ylookup[dc_yl] + columnofs[dc_x]; 
+
+    fracstep = dc_iscale; 
+    frac = dc_texturemid + (dc_yl-centery)*fracstep; 
+
+    while (count >= 4)
+    {
+	dest[0] = colormap[translation[source[frac>>FRACBITS]]];
+	frac += fracstep; 
+	dest[SCREENWIDTH] = colormap[translation[source[frac>>FRACBITS]]];
+	frac += fracstep; 
+	dest[SCREENWIDTH*2] = colormap[translation[source[frac>>FRACBITS]]];
+	frac += fracstep; 
+	dest[SCREENWIDTH*3] = colormap[translation[source[frac>>FRACBITS]]];
+	frac += fracstep; 
+
+	dest += SCREENWIDTH*4;
+	count -= 4;
+    }
+
+    while (count > 0)
+    {
+	*dest = colormap[translation[source[frac>>FRACBITS]]];
+	dest += SCREENWIDTH;
+	frac += fracstep; 
+	count--;
+    }
+} 
+
+
 void R_DrawTranslatedColumnLow (void) 
 { 
     int			count; 
@@ -567,24 +708,25 @@ void R_InitTranslationTables (void)
 // In consequence, flats are not stored by column (like walls),
 //  and the inner loop has to step in texture space u and v.
 //
-int			ds_y; 
-int			ds_x1; 
-int			ds_x2;
+R_THREADLOCAL int		ds_y; 
+R_THREADLOCAL int		ds_x1; 
+R_THREADLOCAL int		ds_x2;
 
-lighttable_t*		ds_colormap; 
+R_THREADLOCAL lighttable_t*	ds_colormap; 
 
-fixed_t			ds_xfrac; 
-fixed_t			ds_yfrac; 
-fixed_t			ds_xstep; 
-fixed_t			ds_ystep;
+R_THREADLOCAL fixed_t		ds_xfrac; 
+R_THREADLOCAL fixed_t		ds_yfrac; 
+R_THREADLOCAL fixed_t		ds_xstep; 
+R_THREADLOCAL fixed_t		ds_ystep;
 
 // start of a 64*64 tile image 
-byte*			ds_source;	
+R_THREADLOCAL byte*		ds_source;	
 
 // just for profiling
 int			dscount;
 
 
+
 //
 // Draws the actual span.
 void R_DrawSpan (void) 
@@ -640,77 +782,64 @@ void R_DrawSpan (void)
 
 
 
-// UNUSED.
+// The flat index for a packed position, as R_DrawSpan works it out
+#define SPANSPOT(p)	((((p) >> 4) & 0x0fc0) | ((p) >> 26))
+
+//
+// R_DrawSpanUnrolled
 // Loop unrolled by 4.
-#if 0
-void R_DrawSpan (void) 
+//
+static void R_DrawSpanUnrolled (void) 
 { 
-    unsigned	position, step;
+    unsigned int	position, step;
+    byte*		source;
+    lighttable_t*	colormap;
+    byte*		dest;
+    int			count;
 
-    byte*	source;
-    byte*	colormap;
-    byte*	dest;
-    
-    unsigned	count;
-    usingned	spot; 
-    unsigned	value;
-    unsigned	temp;
-    unsigned	xtemp;
-    unsigned	ytemp;
-		
-    position = ((ds_xfrac<<10)&0xffff0000) | ((ds_yfrac>>6)&0xffff);
-    step = ((ds_xstep<<10)&0xffff0000) | ((ds_ystep>>6)&0xffff);
+#ifdef RANGECHECK
+    if (ds_x2 < ds_x1
+	|| ds_x1<0
+	|| ds_x2>=SCREENWIDTH
+	|| (unsigned)ds_y>SCREENHEIGHT)
+    {
+	I_Error( "R_DrawSpan: %i to %i at %i",
+		 ds_x1,ds_x2,ds_y);
+    }
+#endif
+
+    position = ((ds_xfrac << 10) & 0xffff0000)
+             | ((ds_yfrac >> 6)  & 0x0000ffff);
+    step = ((ds_xstep << 10) & 0xffff0000)
+         | ((ds_ystep >> 6)  & 0x0000ffff);
 		
     source = ds_source;
     colormap = ds_colormap;
     dest = ylookup[ds_y] + columnofs[ds_x1];	 
     count = ds_x2 - ds_x1 + 1; 
-	
+
     while (count >= 4) 
     { 
-	ytemp = position>>4;
-	ytemp = ytemp & 4032;
-	xtemp = position>>26;
-	spot = xtemp | ytemp;
+	dest[0] = colormap[source[SPANSPOT(position)]]; 
 	position += step;
-	dest[0] = colormap[source[spot]]; 
-
-	ytemp = position>>4;
-	ytemp = ytemp & 4032;
-	xtemp = position>>26;
-	spot = xtemp | ytemp;
+	dest[1] = colormap[source[SPANSPOT(position)]]; 
 	position += step;
-	dest[1] = colormap[source[spot]];
-	
-	ytemp = position>>4;
-	ytemp = ytemp & 4032;
-	xtemp = position>>26;
-	spot = xtemp | ytemp;
+	dest[2] = colormap[source[SPANSPOT(position)]]; 
 	position += step;
-	dest[2] = colormap[source[spot]];
-	
-	ytemp = position>>4;
-	ytemp = ytemp & 4032;
-	xtemp = position>>26;
-	spot = xtemp | ytemp;
+	dest[3] = colormap[source[SPANSPOT(position)]]; 
 	position += step;
-	dest[3] = colormap[source[spot]]; 
 		
 	count -= 4;
 	dest += 4;
     } 
+
     while (count > 0) 
     { 
-	ytemp = position>>4;
-	ytemp = ytemp & 4032;
-	xtemp = position>>26;
-	spot = xtemp | ytemp;
+	*dest++ = colormap[source[SPANSPOT(position)]]; 
 	position += step;
-	*dest++ = colormap[source[spot]]; 
 	count--;
     } 
 } 
-#endif
 
 
 //
@@ -766,6 +895,570 @@ void R_DrawSpanLow (void)
     } while (count--);
 }
 
+//
+// R_AdvanceSpan
+// Moves ds_xfrac and ds_yfrac on by count pixels, exactly as
+//  the span functions step them. They are packed into one word
+//  there, so a carry out of y spills into x.
+//
+void R_AdvanceSpan (int count)
+{
+    unsigned int position, step;
+
+    position = ((ds_xfrac << 10) & 0xffff0000)
+             | ((ds_yfrac >> 6)  & 0x0000ffff);
+    step = ((ds_xstep << 10) & 0xffff0000)
+         | ((ds_ystep >> 6)  & 0x0000ffff);
+
+    position += step * count;
+
+    ds_xfrac = (position >> 16) << 6;
+    ds_yfrac = (position & 0xffff) << 6;
+}
+
+//
+// Vector versions. Texture indices are worked out four pixels at a
+//  time; the lookups can only be done one by one, like the rest.
+// The fuzz effect has none to work out, so these sets use the
+//  unrolled one. The NEON set is only built with NEON_DRAWKERNELS,
+//  until it has been checked on ARM hardware.
+//
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+#define VECTORKERNELS		"sse2"
+
+typedef __m128i			vec4_t;
+
+#define V_SET4(a,b,c,d)		_mm_setr_epi32 (a, b, c, d)
+#define V_DUP(a)		_mm_set1_epi32 (a)
+#define V_ADD(a,b)		_mm_add_epi32 (a, b)
+#define V_AND(a,b)		_mm_and_si128 (a, b)
+#define V_OR(a,b)		_mm_or_si128 (a, b)
+#define V_SHR(a,n)		_mm_srli_epi32 (a, n)
+#define V_SAR(a,n)		_mm_srai_epi32 (a, n)
+#define V_STORE(p,a)		_mm_storeu_si128 ((__m128i*) (p), a)
+
+#elif defined(__ARM_NEON) && defined(NEON_DRAWKERNELS)
+
+#include <arm_neon.h>
+
+#define VECTORKERNELS		"neon"
+
+typedef uint32x4_t		vec4_t;
+
+static inline vec4_t V_SET4 (uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+    uint32_t	v[4] = { a, b, c, d };
+
+    return vld1q_u32 (v);
+}
+
+#define V_DUP(a)		vdupq_n_u32 (a)
+#define V_ADD(a,b)		vaddq_u32 (a, b)
+#define V_AND(a,b)		vandq_u32 (a, b)
+#define V_OR(a,b)		vorrq_u32 (a, b)
+#define V_SHR(a,n)		vshrq_n_u32 (a, n)
+#define V_SAR(a,n)		vreinterpretq_u32_s32 \
+				    (vshrq_n_s32 (vreinterpretq_s32_u32 (a), n))
+#define V_STORE(p,a)		vst1q_u32 ((uint32_t*) (p), a)
+
+#endif
+
+#ifdef VECTORKERNELS
+
+static void R_DrawColumnVector (void) 
+{ 
+    int			count; 
+    byte*		source;
+    byte*		dest;
+    lighttable_t*	colormap;
+    unsigned int	frac;
+    unsigned int	fracstep;
+    unsigned int	spots[4];
+    vec4_t		fracs;
+    vec4_t		fracsteps;
+    vec4_t		mask;
+ 
+    count = dc_yh - dc_yl + 1; 
+
+    if (count <= 0) 
+	return; 
+
+#ifdef RANGECHECK 
+    if ((unsigned)dc_x >= SCREENWIDTH
+	|| dc_yl < 0
+	|| dc_yh >= SCREENHEIGHT) 
+	I_Error ("R_DrawColumn: %i to %i at %i", dc_yl, dc_yh, dc_x); 
+#endif 
+
+    source = dc_source;
+    colormap = dc_colormap;		 
+    dest = ylookup[dc_yl] + columnofs[dc_x];  
+
+    fracstep = dc_iscale; 
+    frac = dc_texturemid + (dc_yl-centery)*dc_iscale; 
+
+    fracs = V_SET4 (frac, frac+fracstep, frac+fracstep*2, frac+fracstep*3);
+    fracsteps = V_DUP (fracstep*4);
+    mask = V_DUP (127);
+
+    while (count >= 4) 
+    { 
+	V_STORE (spots, V_AND (V_SHR (fracs, FRACBITS), mask));
+	fracs = V_ADD (fracs, fracsteps);
+
+	dest[0] = colormap[source[spots[0]]]; 
+	dest[SCREENWIDTH] = colormap[source[spots[1]]]; 
+	dest[SCREENWIDTH*2] = colormap[source[spots[2]]]; 
+	dest[SCREENWIDTH*3] = colormap[source[spots[3]]];
+
+	frac += fracstep*4;
+	dest += SCREENWIDTH*4; 
+	count -= 4;
+    } 
+	
+    while (count > 0)
+    { 
+	*dest = colormap[source[(frac>>FRACBITS)&127]]; 
+	dest += SCREENWIDTH; 
+	frac += fracstep; 
+	count--;
+    } 
+}
+
+
+static void R_DrawTranslatedColumnVector (void) 
+{ 
+    int			count; 
+    byte*		source;
+    byte*		translation;
+    byte*		dest;
+    lighttable_t*	colormap;
+    fixed_t		frac;
+    fixed_t		fracstep;
+    int			spots[4];
+    vec4_t		fracs;
+    vec4_t		fracsteps;
+ 
+    count = dc_yh - dc_yl + 1; 
+
+    if (count <= 0) 
+	return; 
+
+#ifdef RANGECHECK 
+    if ((unsigned)dc_x >= SCREENWIDTH
+	|| dc_yl < 0
+	|| dc_yh >= SCREENHEIGHT)
+    {
+	I_Error ( "R_DrawColumn: %i to %i at %i",
+		  dc_yl, dc_yh, dc_x);
+    }
+#endif 
+
+    source = dc_source;
+    translation = dc_translation;
+    colormap = dc_colormap;		 
+    dest = ylookup[dc_yl] + columnofs[dc_x];  
+
+    fracstep = dc_iscale; 
+    frac = dc_texturemid + (dc_yl-centery)*fracstep; 
+
+    fracs = V_SET4 (frac, frac+fracstep, frac+fracstep*2, frac+fracstep*3);
+    fracsteps = V_DUP (fracstep*4);
+
+    while (count >= 4) 
+    { 
+	V_STORE (spots, V_SAR (fracs, FRACBITS));
+	fracs = V_ADD (fracs, fracsteps);
+
+	dest[0] = colormap[translation[source[spots[0]]]]; 
+	dest[SCREENWIDTH] = colormap[translation[source[spots[1]]]]; 
+	dest[SCREENWIDTH*2] = colormap[translation[source[spots[2]]]]; 
+	dest[SCREENWIDTH*3] = colormap[translation[source[spots[3]]]];
+
+	frac += fracstep*4;
+	dest += SCREENWIDTH*4; 
+	count -= 4;
+    } 
+	
+    while (count > 0)
+    { 
+	*dest = colormap[translation[source[frac>>FRACBITS]]]; 
+	dest += SCREENWIDTH; 
+	frac += fracstep; 
+	count--;
+    } 
+}
+
+
+static void R_DrawSpanVector (void) 
+{ 
+    unsigned int	position, step;
+    byte*		source;
+    lighttable_t*	colormap;
+    byte*		dest;
+    int			count;
+    int			i;
+    unsigned int	spots[8];
+    vec4_t		positions;
+    vec4_t		steps;
+    vec4_t		ymask;
+
+#ifdef RANGECHECK
+    if (ds_x2 < ds_x1
+	|| ds_x1<0
+	|| ds_x2>=SCREENWIDTH
+	|| (unsigned)ds_y>SCREENHEIGHT)
+    {
+	I_Error( "R_DrawSpan: %i to %i at %i",
+		 ds_x1,ds_x2,ds_y);
+    }
+#endif
+
+    position = ((ds_xfrac << 10) & 0xffff0000)
+             | ((ds_yfrac >> 6)  & 0x0000ffff);
+    step = ((ds_xstep << 10) & 0xffff0000)
+         | ((ds_ystep >> 6)  & 0x0000ffff);
+		
+    source = ds_source;
+    colormap = ds_colormap;
+    dest = ylookup[ds_y] + columnofs[ds_x1];	 
+    count = ds_x2 - ds_x1 + 1; 
+
+    positions = V_SET4 (position, position+step,
+			position+step*2, position+step*3);
+    steps = V_DUP (step*4);
+    ymask = V_DUP (0x0fc0);
+
+    while (count >= 8)
+    {
+	V_STORE (spots,
+		 V_OR (V_AND (V_SHR (positions, 4), ymask),
+		       V_SHR (positions, 26)));
+	positions = V_ADD (positions, steps);
+	V_STORE (spots+4,
+		 V_OR (V_AND (V_SHR (positions, 4), ymask),
+		       V_SHR (positions, 26)));
+	positions = V_ADD (positions, steps);
+
+	for (i=0 ; i<8 ; i++)
+	    dest[i] = colormap[source[spots[i]]];
+
+	position += step*8;
+	dest += 8;
+	count -= 8;
+    }
+
+    while (count > 0) 
+    { 
+	*dest++ = colormap[source[SPANSPOT(position)]]; 
+	position += step;
+	count--;
+    } 
+}
+
+#endif
+
+
+
+//
+// Sets of drawing functions to pick from
+//
+static drawkernels_t	kernels[] =
+{
+    { "scalar", R_DrawColumn, R_DrawFuzzColumn,
+      R_DrawTranslatedColumn, R_DrawSpan },
+    { "unrolled", R_DrawColumnUnrolled, R_DrawFuzzColumnUnrolled,
+      R_DrawTranslatedColumnUnrolled, R_DrawSpanUnrolled },
+#ifdef VECTORKERNELS
+    { VECTORKERNELS, R_DrawColumnVector, R_DrawFuzzColumnUnrolled,
+      R_DrawTranslatedColumnVector, R_DrawSpanVector },
+#endif
+};
+
+// Unrolled. The lookups take most of the time, so the vector sets
+// only keep up with it where measured (-kernelbench).
+drawkernels_t*	drawkernels = &kernels[1];
+
+
+
+//
+// -kernelbench
+// The same random columns and spans are drawn with every set, once
+//  from the same screen to check they all come out the same, then
+//  over and over to time them.
+//
+#define BENCHDRAWS		1024
+#define BENCHPIXELS		(16*1024*1024)
+
+enum
+{
+    BENCH_COLUMN,
+    BENCH_FUZZCOLUMN,
+    BENCH_TRANSLATEDCOLUMN,
+    BENCH_SPAN,
+    NUMBENCHES
+};
+
+static char*		benchnames[NUMBENCHES] =
+{
+    "R_DrawColumn",
+    "R_DrawFuzzColumn",
+    "R_DrawTranslatedColumn",
+    "R_DrawSpan"
+};
+
+typedef struct
+{
+    int			x1, x2;
+    int			y1, y2;
+    fixed_t		frac, yfrac;
+    fixed_t		step, ystep;
+    lighttable_t*	colormap;
+    byte*		translation;
+} benchdraw_t;
+
+static benchdraw_t	benchdraws[BENCHDRAWS];
+static byte		benchtexture[1024];
+static byte		benchflat[64*64];
+static unsigned int	benchseed;
+
+static unsigned int R_BenchRandom (void)
+{
+    benchseed = benchseed * 1103515245 + 12345;
+    return (benchseed >> 16) | (benchseed << 16);
+}
+
+static double R_DrawTimeUS (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+
+//
+// R_MakeBenchDraws
+// Returns how many pixels drawing them all covers.
+//
+static int R_MakeBenchDraws (int bench)
+{
+    benchdraw_t*	d;
+    int			start;
+    int			pixels = 0;
+    int			i;
+
+    for (i=0 ; i<BENCHDRAWS ; i++)
+    {
+	d = &benchdraws[i];
+	d->colormap = colormaps + (R_BenchRandom () % 32) * 256;
+	d->translation = translationtables + (R_BenchRandom () % 3) * 256;
+
+	if (bench == BENCH_SPAN)
+	{
+	    d->y1 = R_BenchRandom () % viewheight;
+	    d->x1 = R_BenchRandom () % viewwidth;
+	    d->x2 = d->x1 + R_BenchRandom () % (viewwidth - d->x1);
+	    d->frac = R_BenchRandom ();
+	    d->yfrac = R_BenchRandom ();
+	    d->step = R_BenchRandom () % (4*FRACUNIT) - 2*FRACUNIT;
+	    d->ystep = R_BenchRandom () % (4*FRACUNIT) - 2*FRACUNIT;
+	    pixels += d->x2 - d->x1 + 1;
+	    continue;
+	}
+
+	d->x1 = R_BenchRandom () % viewwidth;
+	d->y1 = R_BenchRandom () % viewheight;
+	d->y2 = d->y1 + R_BenchRandom () % (viewheight - d->y1);
+	d->step = FRACUNIT/4 + R_BenchRandom () % (2*FRACUNIT);
+
+	// Sprite columns aren't wrapped, so stay in the texture
+	start = R_BenchRandom () % 64;
+	d->frac = (start << FRACBITS) - (d->y1 - centery) * d->step;
+
+	if (bench == BENCH_FUZZCOLUMN)
+	{
+	    if (!d->y1)
+		d->y1 = 1;
+	    if (d->y2 == viewheight-1)
+		d->y2 = viewheight-2;
+	}
+
+	if (d->y2 >= d->y1)
+	    pixels += d->y2 - d->y1 + 1;
+    }
+
+    return pixels;
+}
+
+
+static void R_DrawBench (int bench, void (*draw) (void))
+{
+    benchdraw_t*	d;
+    int			i;
+
+    for (i=0 ; i<BENCHDRAWS ; i++)
+    {
+	d = &benchdraws[i];
+
+	if (bench == BENCH_SPAN)
+	{
+	    ds_y = d->y1;
+	    ds_x1 = d->x1;
+	    ds_x2 = d->x2;
+	    ds_xfrac = d->frac;
+	    ds_yfrac = d->yfrac;
+	    ds_xstep = d->step;
+	    ds_ystep = d->ystep;
+	    ds_colormap = d->colormap;
+	    ds_source = benchflat;
+	}
+	else
+	{
+	    dc_x = d->x1;
+	    dc_yl = d->y1;
+	    dc_yh = d->y2;
+	    dc_texturemid = d->frac;
+	    dc_iscale = d->step;
+	    dc_colormap = d->colormap;
+	    dc_translation = d->translation;
+	    dc_source = benchtexture;
+	}
+
+	draw ();
+    }
+}
+
+
+static unsigned int R_ViewChecksum (void)
+{
+    unsigned int	sum = 2166136261u;
+    int			x, y;
+
+    for (y=0 ; y<viewheight ; y++)
+	for (x=0 ; x<scaledviewwidth ; x++)
+	    sum = (sum ^ ylookup[y][columnofs[x]]) * 16777619u;
+
+    return sum;
+}
+
+
+static void R_BenchmarkKernels (void)
+{
+    void		(*draw) (void);
+    unsigned int	sums[arrlen(kernels)];
+    int			bench;
+    int			pixels;
+    unsigned int	passes;
+    unsigned int	i, k;
+    int			x, y;
+    double		start;
+    double		us;
+
+    // Never drew anything
+    if (!viewheight || !ylookup[0])
+	return;
+
+    benchseed = 1;
+
+    for (i=0 ; i<arrlen(benchtexture) ; i++)
+	benchtexture[i] = R_BenchRandom ();
+    for (i=0 ; i<arrlen(benchflat) ; i++)
+	benchflat[i] = R_BenchRandom ();
+
+    for (bench=0 ; bench<NUMBENCHES ; bench++)
+    {
+	pixels = R_MakeBenchDraws (bench);
+	passes = BENCHPIXELS / pixels + 1;
+
+	printf ("%s:", benchnames[bench]);
+
+	for (k=0 ; k<arrlen(kernels) ; k++)
+	{
+	    switch (bench)
+	    {
+	      case BENCH_COLUMN:
+		draw = kernels[k].column;
+		break;
+	      case BENCH_FUZZCOLUMN:
+		draw = kernels[k].fuzzcolumn;
+		break;
+	      case BENCH_TRANSLATEDCOLUMN:
+		draw = kernels[k].translatedcolumn;
+		break;
+	      default:
+		draw = kernels[k].span;
+		break;
+	    }
+
+	    for (y=0 ; y<viewheight ; y++)
+		for (x=0 ; x<scaledviewwidth ; x++)
+		    ylookup[y][columnofs[x]] = x * 7 + y * 13;
+
+	    fuzzpos = 0;
+	    R_DrawBench (bench, draw);
+	    sums[k] = R_ViewChecksum ();
+
+	    start = R_DrawTimeUS ();
+	    for (i=0 ; i<passes ; i++)
+		R_DrawBench (bench, draw);
+	    us = R_DrawTimeUS () - start;
+
+	    printf ("%s %s %.1f Mpixels/s%s", k ? "," : "", kernels[k].name,
+		    (double) pixels * passes / us,
+		    sums[k] != sums[0] ? " (drew differently)" : "");
+	}
+
+	printf ("\n");
+    }
+}
+
+
+//
+// R_InitKernels
+//
+void R_InitKernels (void)
+{
+    unsigned int	i;
+    int			p;
+
+    //!
+    // @arg <name>
+    // @category obscure
+    //
+    // Draw columns and spans with the named set of functions: scalar,
+    // unrolled, or the vector ones, sse2 or neon, where built for
+    // them (neon only with NEON_DRAWKERNELS). All draw exactly the same.
+    //
+
+    p = M_CheckParmWithArgs ("-drawkernels", 1);
+    if (p > 0)
+    {
+	for (i=0 ; i<arrlen(kernels) ; i++)
+	    if (!strcasecmp (myargv[p+1], kernels[i].name))
+		break;
+
+	if (i == arrlen(kernels))
+	    I_Error ("R_InitKernels: no %s drawing functions in this build",
+		     myargv[p+1]);
+
+	drawkernels = &kernels[i];
+    }
+
+    //!
+    // @category obscure
+    //
+    // On exit, draw the same random columns and spans with every set
+    // of drawing functions, and print how fast each was and whether
+    // any drew differently from the scalar ones.
+    //
+
+    if (M_ParmExists ("-kernelbench"))
+	I_AtExit (R_BenchmarkKernels, true);
+}
+
 //
 // R_InitBuffer 
 // Creats lookup tables that avoid
@@ -815,6 +1508,10 @@ void R_FillBackScreen (void)
     byte*	dest; 
     int		x;
     int		y; 
+    int		windowx;
+    int		windowy;
+    int		windowwidth;
+    int		windowheight;
     patch_t*	patch;
 
     // DOOM border patch.
@@ -855,6 +1552,16 @@ void R_FillBackScreen (void)
     src = W_CacheLumpName(name, PU_CACHE); 
     dest = background_buffer;
 	 
+#ifdef SCREEN_SCALED
+    // Tile the flat in 320x200 space so it looks the same at any size
+    for (y=0 ; y<SCREENHEIGHT-SBARHEIGHT ; y++) 
+    { 
+	byte *row = src + ((FROMSCREENY(y)&63)<<6);
+
+	for (x=0 ; x<SCREENWIDTH ; x++) 
+	    *dest++ = row[FROMSCREENX(x)&63];
+    } 
+#else
     for (y=0 ; y<SCREENHEIGHT-SBARHEIGHT ; y++) 
     { 
 	for (x=0 ; x<SCREENWIDTH/64 ; x++) 
@@ -869,43 +1576,50 @@ void R_FillBackScreen (void)
 	    dest += (SCREENWIDTH&63); 
 	} 
     } 
+#endif
      
     // Draw screen and bezel; this is done to a separate screen buffer.
+    // The border patches are placed in 320x200 coordinates.
+
+    windowx = FROMSCREENX(viewwindowx);
+    windowy = FROMSCREENY(viewwindowy);
+    windowwidth = FROMSCREENX(scaledviewwidth);
+    windowheight = FROMSCREENY(viewheight);
 
     V_UseBuffer(background_buffer);
 
     patch = W_CacheLumpName(DEH_String("brdr_t"),PU_CACHE);
 
-    for (x=0 ; x<scaledviewwidth ; x+=8)
-	V_DrawPatch(viewwindowx+x, viewwindowy-8, patch);
+    for (x=0 ; x<windowwidth ; x+=8)
+	V_DrawPatch(windowx+x, windowy-8, patch);
     patch = W_CacheLumpName(DEH_String("brdr_b"),PU_CACHE);
 
-    for (x=0 ; x<scaledviewwidth ; x+=8)
-	V_DrawPatch(viewwindowx+x, viewwindowy+viewheight, patch);
+    for (x=0 ; x<windowwidth ; x+=8)
+	V_DrawPatch(windowx+x, windowy+windowheight, patch);
     patch = W_CacheLumpName(DEH_String("brdr_l"),PU_CACHE);
 
-    for (y=0 ; y<viewheight ; y+=8)
-	V_DrawPatch(viewwindowx-8, viewwindowy+y, patch);
+    for (y=0 ; y<windowheight ; y+=8)
+	V_DrawPatch(windowx-8, windowy+y, patch);
     patch = W_CacheLumpName(DEH_String("brdr_r"),PU_CACHE);
 
-    for (y=0 ; y<viewheight ; y+=8)
-	V_DrawPatch(viewwindowx+scaledviewwidth, viewwindowy+y, patch);
+    for (y=0 ; y<windowheight ; y+=8)
+	V_DrawPatch(windowx+windowwidth, windowy+y, patch);
 
     // Draw beveled edge. 
-    V_DrawPatch(viewwindowx-8,
-                viewwindowy-8,
+    V_DrawPatch(windowx-8,
+                windowy-8,
                 W_CacheLumpName(DEH_String("brdr_tl"),PU_CACHE));
     
-    V_DrawPatch(viewwindowx+scaledviewwidth,
-                viewwindowy-8,
+    V_DrawPatch(windowx+windowwidth,
+                windowy-8,
                 W_CacheLumpName(DEH_String("brdr_tr"),PU_CACHE));
     
-    V_DrawPatch(viewwindowx-8,
-                viewwindowy+viewheight,
+    V_DrawPatch(windowx-8,
+                windowy+windowheight,
                 W_CacheLumpName(DEH_String("brdr_bl"),PU_CACHE));
     
-    V_DrawPatch(viewwindowx+scaledviewwidth,
-                viewwindowy+viewheight,
+    V_DrawPatch(windowx+windowwidth,
+                windowy+windowheight,
                 W_CacheLumpName(DEH_String("brdr_br"),PU_CACHE));
 
     V_RestoreBuffer();
@@ -21,17 +21,24 @@
 #define __R_DRAW__
 
 
+// With RENDER_THREADS, each of the strip workers in r_strips.c
+// draws with its own copy of the drawing functions' arguments.
+#ifdef RENDER_THREADS
+#define R_THREADLOCAL	__thread
+#else
+#define R_THREADLOCAL
+#endif
 
 
-extern lighttable_t*	dc_colormap;
-extern int		dc_x;
-extern int		dc_yl;
-extern int		dc_yh;
-extern fixed_t		dc_iscale;
-extern fixed_t		dc_texturemid;
+extern R_THREADLOCAL lighttable_t*	dc_colormap;
+extern R_THREADLOCAL int		dc_x;
+extern R_THREADLOCAL int		dc_yl;
+extern R_THREADLOCAL int		dc_yh;
+extern R_THREADLOCAL fixed_t		dc_iscale;
+extern R_THREADLOCAL fixed_t		dc_texturemid;
 
 // first pixel in a column
-extern byte*		dc_source;		
+extern R_THREADLOCAL byte*		dc_source;		
 
 
 // The span blitting interface.
@@ -44,6 +51,11 @@ void 	R_DrawColumnLow (void);
 void 	R_DrawFuzzColumn (void);
 void 	R_DrawFuzzColumnLow (void);
 
+// Where the effect is in its pattern, and moving it on
+// past a column without drawing it.
+extern R_THREADLOCAL int	fuzzpos;
+void	R_SkipFuzzColumn (void);
+
 // Draw with color translation tables,
 //  for player sprite rendering,
 //  Green/Red/Blue/Indigo shirts.
@@ -55,22 +67,22 @@ R_VideoErase
 ( unsigned	ofs,
   int		count );
 
-extern int		ds_y;
-extern int		ds_x1;
-extern int		ds_x2;
+extern R_THREADLOCAL int		ds_y;
+extern R_THREADLOCAL int		ds_x1;
+extern R_THREADLOCAL int		ds_x2;
 
-extern lighttable_t*	ds_colormap;
+extern R_THREADLOCAL lighttable_t*	ds_colormap;
 
-extern fixed_t		ds_xfrac;
-extern fixed_t		ds_yfrac;
-extern fixed_t		ds_xstep;
-extern fixed_t		ds_ystep;
+extern R_THREADLOCAL fixed_t		ds_xfrac;
+extern R_THREADLOCAL fixed_t		ds_yfrac;
+extern R_THREADLOCAL fixed_t		ds_xstep;
+extern R_THREADLOCAL fixed_t		ds_ystep;
 
 // start of a 64*64 tile image
-extern byte*		ds_source;		
+extern R_THREADLOCAL byte*		ds_source;		
 
 extern byte*		translationtables;
-extern byte*		dc_translation;
+extern R_THREADLOCAL byte*		dc_translation;
 
 
 // Span blitting for rows, floor/ceiling.
@@ -80,6 +92,27 @@ void 	R_DrawSpan (void);
 // Low resolution mode, 160x200?
 void 	R_DrawSpanLow (void);
 
+// Moves ds_xfrac and ds_yfrac on by count pixels.
+void	R_AdvanceSpan (int count);
+
+// Sets of the full detail drawing functions, which all draw exactly
+// the same: the ones above, unrolled ones, and vector ones where built
+// for SSE2, or for NEON with NEON_DRAWKERNELS. R_ExecuteSetViewSize
+// draws with drawkernels.
+typedef struct
+{
+    char*	name;
+    void	(*column) (void);
+    void	(*fuzzcolumn) (void);
+    void	(*translatedcolumn) (void);
+    void	(*span) (void);
+} drawkernels_t;
+
+extern drawkernels_t*	drawkernels;
+
+// At startup: -drawkernels and -kernelbench
+void	R_InitKernels (void);
+
 
 void
 R_InitBuffer
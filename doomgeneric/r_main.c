@@ -22,18 +22,26 @@
 
 
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <time.h>
 
 
 #include "doomdef.h"
 #include "d_loop.h"
+#include "doomstat.h"
 
+#include "m_argv.h"
 #include "m_bbox.h"
 #include "m_menu.h"
 
 #include "r_local.h"
 #include "r_sky.h"
+#ifdef RENDER_THREADS
+#include "r_strips.h"
+#include "i_system.h"
+#endif
 
 
 
@@ -46,6 +54,9 @@
 
 int			viewangleoffset;
 
+// -nolimits: visplanes, drawsegs and openings grow as needed
+boolean			limitremoving;
+
 // increment every time a check is made
 int			validcount = 1;		
 
@@ -112,6 +123,32 @@ void (*fuzzcolfunc) (void);
 void (*transcolfunc) (void);
 void (*spanfunc) (void);
 
+// Last view rendered while the game was frozen, see R_RestoreFrozenView
+static byte		frozenview[SCREENWIDTH*SCREENHEIGHT];
+static boolean		frozenviewvalid;
+static int		frozenleveltime;
+static int		frozenstarttic;
+static player_t*	frozenplayer;
+
+boolean			fuzzdrawn;
+
+#ifdef RENDER_THREADS
+// -renderbench: every frame is drawn on the main thread alone and with
+// one to RENDERBENCH_THREADS render threads, timing each
+#define RENDERBENCH_THREADS	4
+
+static boolean		renderbench;
+static struct
+{
+    int			frames;
+    int			differed;
+    double		us[RENDERBENCH_THREADS+1];
+} benchstats;
+
+// The view as the first, untimed render drew it
+static byte		benchview[SCREENWIDTH*SCREENHEIGHT];
+#endif
+
 
 
 //
@@ -622,7 +659,7 @@ void R_InitLightTables (void)
 	startmap = ((LIGHTLEVELS-1-i)*2)*NUMCOLORMAPS/LIGHTLEVELS;
 	for (j=0 ; j<MAXLIGHTZ ; j++)
 	{
-	    scale = FixedDiv ((SCREENWIDTH/2*FRACUNIT), (j+1)<<LIGHTZSHIFT);
+	    scale = FixedDiv ((ORIGWIDTH/2*FRACUNIT), (j+1)<<LIGHTZSHIFT);
 	    scale >>= LIGHTSCALESHIFT;
 	    level = startmap - scale/DISTMAP;
 	    
@@ -674,6 +711,7 @@ void R_ExecuteSetViewSize (void)
     int		startmap; 	
 
     setsizeneeded = false;
+    frozenviewvalid = false;
 
     if (setblocks == 11)
     {
@@ -682,8 +720,8 @@ void R_ExecuteSetViewSize (void)
     }
     else
     {
-	scaledviewwidth = setblocks*32;
-	viewheight = (setblocks*168/10)&~7;
+	scaledviewwidth = TOSCREENX(setblocks*32);
+	viewheight = TOSCREENY((setblocks*168/10)&~7);
     }
     
     detailshift = setdetail;
@@ -697,10 +735,10 @@ void R_ExecuteSetViewSize (void)
 
     if (!detailshift)
     {
-	colfunc = basecolfunc = R_DrawColumn;
-	fuzzcolfunc = R_DrawFuzzColumn;
-	transcolfunc = R_DrawTranslatedColumn;
-	spanfunc = R_DrawSpan;
+	colfunc = basecolfunc = drawkernels->column;
+	fuzzcolfunc = drawkernels->fuzzcolumn;
+	transcolfunc = drawkernels->translatedcolumn;
+	spanfunc = drawkernels->span;
     }
     else
     {
@@ -710,13 +748,18 @@ void R_ExecuteSetViewSize (void)
 	spanfunc = R_DrawSpanLow;
     }
 
+#ifdef RENDER_THREADS
+    R_SetStripFuncs ();
+#endif
+
     R_InitBuffer (scaledviewwidth, viewheight);
 	
     R_InitTextureMapping ();
     
     // psprite scales
-    pspritescale = FRACUNIT*viewwidth/SCREENWIDTH;
-    pspriteiscale = FRACUNIT*SCREENWIDTH/viewwidth;
+    // (weapon sprites are positioned for a 320 wide view)
+    pspritescale = FRACUNIT*viewwidth/ORIGWIDTH;
+    pspriteiscale = FRACUNIT*ORIGWIDTH/viewwidth;
     
     // thing clipping
     for (i=0 ; i<viewwidth ; i++)
@@ -743,7 +786,7 @@ void R_ExecuteSetViewSize (void)
 	startmap = ((LIGHTLEVELS-1-i)*2)*NUMCOLORMAPS/LIGHTLEVELS;
 	for (j=0 ; j<MAXLIGHTSCALE ; j++)
 	{
-	    level = startmap - j*SCREENWIDTH/(viewwidth<<detailshift)/DISTMAP;
+	    level = startmap - j*ORIGWIDTH/(viewwidth<<detailshift)/DISTMAP;
 	    
 	    if (level < 0)
 		level = 0;
@@ -758,6 +801,39 @@ void R_ExecuteSetViewSize (void)
 
 
 
+#ifdef RENDER_THREADS
+static double R_BenchTimeUS (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+
+static void R_PrintRenderBench (void)
+{
+    int		n;
+
+    if (!benchstats.frames)
+	return;
+
+    printf ("R_RenderPlayerView: %i frames, %.2f ms each on the main thread",
+	    benchstats.frames, benchstats.us[0] / benchstats.frames / 1000.0);
+
+    for (n=1 ; n<=RENDERBENCH_THREADS ; n++)
+	printf (", %.2f ms with %i render thread%s (%.2fx)",
+		benchstats.us[n] / benchstats.frames / 1000.0,
+		n, n > 1 ? "s" : "", benchstats.us[0] / benchstats.us[n]);
+
+    if (benchstats.differed)
+	printf (", %i frames drawn differently\n", benchstats.differed);
+    else
+	printf (", all drawn the same\n");
+}
+#endif
+
+
+
 //
 // R_Init
 //
@@ -766,6 +842,13 @@ void R_ExecuteSetViewSize (void)
 
 void R_Init (void)
 {
+    //!
+    // Let the renderer use as many visplanes, drawsegs and openings
+    // as a view needs, instead of stopping at the vanilla limits.
+    //
+
+    limitremoving = M_ParmExists ("-nolimits");
+
     R_InitData ();
     printf (".");
     R_InitPointToAngle ();
@@ -776,12 +859,29 @@ void R_Init (void)
 
     R_SetViewSize (screenblocks, detailLevel);
     R_InitPlanes ();
+    R_InitDrawSegs ();
     printf (".");
     R_InitLightTables ();
     printf (".");
     R_InitSkyMap ();
     R_InitTranslationTables ();
+    R_InitKernels ();
     printf (".");
+
+#ifdef RENDER_THREADS
+    R_InitStrips ();
+
+    //!
+    // @category obscure
+    //
+    // Draw every frame on the main thread alone and then with one to
+    // four render threads, and print how long each took on exit.
+    //
+
+    renderbench = M_ParmExists ("-renderbench");
+    if (renderbench)
+	I_AtExit (R_PrintRenderBench, true);
+#endif
 	
     framecount = 0;
 }
@@ -860,8 +960,56 @@ void R_SetupFrame (player_t* player)
 //
 // R_RenderView
 //
-void R_RenderPlayerView (player_t* player)
-{	
+//
+// R_RestoreFrozenView
+// While the game is paused, or stopped by a menu, the world cannot change
+// until leveltime moves on again. The view rendered then is kept, and
+// copied back instead of being rendered again as long as that holds.
+// Shadow (fuzz) columns change every frame, so a view with any of those
+// is never kept.
+//
+static boolean R_RestoreFrozenView (player_t* player)
+{
+    int		y;
+
+    if (!frozenviewvalid
+     || leveltime != frozenleveltime
+     || levelstarttic != frozenstarttic
+     || player != frozenplayer)
+    {
+	return false;
+    }
+
+    for (y=0 ; y<viewheight ; y++)
+	memcpy (I_VideoBuffer + (viewwindowy+y)*SCREENWIDTH + viewwindowx,
+		frozenview + y*scaledviewwidth,
+		scaledviewwidth);
+
+    return true;
+}
+
+static void R_SaveFrozenView (player_t* player)
+{
+    int		y;
+
+    frozenviewvalid = false;
+
+    if ((!paused && !menuactive) || fuzzdrawn)
+	return;
+
+    for (y=0 ; y<viewheight ; y++)
+	memcpy (frozenview + y*scaledviewwidth,
+		I_VideoBuffer + (viewwindowy+y)*SCREENWIDTH + viewwindowx,
+		scaledviewwidth);
+
+    frozenviewvalid = true;
+    frozenleveltime = leveltime;
+    frozenstarttic = levelstarttic;
+    frozenplayer = player;
+}
+
+static void R_RenderView (player_t* player)
+{
     R_SetupFrame (player);
 
     // Clear buffers.
@@ -886,6 +1034,90 @@ void R_RenderPlayerView (player_t* player)
     
     R_DrawMasked ();
 
+#ifdef RENDER_THREADS
+    R_FlushStrips ();
+#endif
+
     // Check for new console commands.
     NetUpdate ();				
 }
+
+#ifdef RENDER_THREADS
+//
+// R_BenchmarkView
+// Renders the view once untimed, so that composing textures and
+// filling caches the first time does not count, then once for each
+// number of render threads, checking they all drew the same. Drawing
+// again can read different bytes past the end of a patch once the
+// first render has loaded textures, so the first one's view is what
+// is left on the screen, as without -renderbench.
+//
+static void R_BenchmarkView (player_t* player)
+{
+    int			threads = R_GetRenderThreads ();
+    int			startfuzzpos = fuzzpos;
+    unsigned int	sums[RENDERBENCH_THREADS+1];
+    double		start;
+    int			n, x, y;
+    byte*		row;
+
+    R_SetRenderThreads (0);
+    R_RenderView (player);
+
+    for (y=0 ; y<viewheight ; y++)
+	memcpy (benchview + y*scaledviewwidth,
+		I_VideoBuffer + (viewwindowy+y)*SCREENWIDTH + viewwindowx,
+		scaledviewwidth);
+
+    for (n=0 ; n<=RENDERBENCH_THREADS ; n++)
+    {
+	R_SetRenderThreads (n);
+	fuzzpos = startfuzzpos;
+
+	start = R_BenchTimeUS ();
+	R_RenderView (player);
+	benchstats.us[n] += R_BenchTimeUS () - start;
+
+	// FNV-1a over the view window
+	sums[n] = 2166136261u;
+	for (y=0 ; y<viewheight ; y++)
+	{
+	    row = I_VideoBuffer + (viewwindowy+y)*SCREENWIDTH + viewwindowx;
+	    for (x=0 ; x<scaledviewwidth ; x++)
+		sums[n] = (sums[n] ^ row[x]) * 16777619u;
+	}
+    }
+
+    for (n=1 ; n<=RENDERBENCH_THREADS ; n++)
+	if (sums[n] != sums[0])
+	{
+	    benchstats.differed++;
+	    break;
+	}
+
+    for (y=0 ; y<viewheight ; y++)
+	memcpy (I_VideoBuffer + (viewwindowy+y)*SCREENWIDTH + viewwindowx,
+		benchview + y*scaledviewwidth,
+		scaledviewwidth);
+
+    R_SetRenderThreads (threads);
+    benchstats.frames++;
+}
+#endif
+
+void R_RenderPlayerView (player_t* player)
+{	
+    if (R_RestoreFrozenView (player))
+	return;
+
+    fuzzdrawn = false;
+
+#ifdef RENDER_THREADS
+    if (renderbench)
+	R_BenchmarkView (player);
+    else
+#endif
+    R_RenderView (player);
+
+    R_SaveFrozenView (player);
+}
@@ -46,6 +46,8 @@ extern fixed_t		projection;
 
 extern int		validcount;
 
+extern boolean		limitremoving;
+
 extern int		linecount;
 extern int		loopcount;
 
@@ -96,6 +98,9 @@ extern void		(*fuzzcolfunc) (void);
 // No shadow effects on floors.
 extern void		(*spanfunc) (void);
 
+// Set when shadow columns were drawn in the current view
+extern boolean		fuzzdrawn;
+
 
 //
 // Utility functions.
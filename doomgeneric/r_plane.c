@@ -21,8 +21,11 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "i_system.h"
+#include "m_argv.h"
+#include "m_misc.h"
 #include "z_zone.h"
 #include "w_wad.h"
 
@@ -42,16 +45,65 @@ planefunction_t		ceilingfunc;
 //
 
 // Here comes the obnoxious "visplane".
+// There are MAXVISPLANES, or as many as a view needs with -nolimits.
 #define MAXVISPLANES	128
-visplane_t		visplanes[MAXVISPLANES];
+visplane_t*		visplanes;
 visplane_t*		lastvisplane;
 visplane_t*		floorplane;
 visplane_t*		ceilingplane;
+int			numvisplanes;
+
+// The visplanes by height, picnum and lightlevel, for R_FindPlane,
+// as the first of each chain (-1 for none). Only the first visplane
+// with each is linked in: a lookup never gets to the copies that
+// R_CheckPlane makes of it.
+#define VISPLANEHASH	128
+#define visplane_hash(height,picnum,lightlevel) \
+	((unsigned) ((picnum)*3 + (lightlevel) + (height)*7) & (VISPLANEHASH-1))
+
+static int		visplanehash[VISPLANEHASH];
+
+// -planebench: the lookups and splits of the game, up to a limit,
+// replayed on exit through the hash and through the linear scan
+// R_FindPlane used to do
+#define PLANEBENCH_EVENTS	(1 << 20)
+
+typedef enum
+{
+    PLANE_CLEAR,
+    PLANE_FIND,
+    PLANE_SPLIT
+} planeop_t;
+
+typedef struct
+{
+    planeop_t	op;
+    fixed_t	height;
+    int		picnum;
+    int		lightlevel;
+} planeevent_t;
+
+static planeevent_t*	planeevents;
+static int		numplaneevents;
+static int		maxplaneevents;
 
 // ?
 #define MAXOPENINGS	SCREENWIDTH*64
-short			openings[MAXOPENINGS];
+short*			openings;
 short*			lastopening;
+int			numopenings;
+
+// -limitstats: the most of each used in a frame, per map
+static boolean		limitstats;
+static struct
+{
+    int		episode;
+    int		map;
+    int		frames;
+    int		visplanes;
+    int		drawsegs;
+    int		openings;
+} highwater;
 
 
 //
@@ -87,13 +139,349 @@ fixed_t			cachedystep[SCREENHEIGHT];
 
 
 
+static void
+R_RecordPlane
+( planeop_t	op,
+  fixed_t	height,
+  int		picnum,
+  int		lightlevel )
+{
+    planeevent_t*	ev;
+
+    if (numplaneevents == maxplaneevents)
+    {
+	if (maxplaneevents == PLANEBENCH_EVENTS)
+	    return;
+
+	maxplaneevents = maxplaneevents ? maxplaneevents * 2 : 4096;
+	planeevents = realloc (planeevents, maxplaneevents * sizeof(*planeevents));
+
+	if (!planeevents)
+	    I_Error ("R_RecordPlane: couldn't allocate %i events", maxplaneevents);
+    }
+
+    ev = &planeevents[numplaneevents++];
+    ev->op = op;
+    ev->height = height;
+    ev->picnum = picnum;
+    ev->lightlevel = lightlevel;
+}
+
+
+//
+// R_ReplayPlanes
+// Runs the recorded events on bare visplanes, finding them by hash
+// or by scanning. Returns a checksum of the visplanes found.
+//
+static unsigned int R_ReplayPlanes (visplane_t* planes, boolean hashed)
+{
+    planeevent_t*	ev;
+    visplane_t*		check;
+    int			count = 0;
+    int			i;
+    unsigned int	hash;
+    unsigned int	sum = 0;
+
+    memset (visplanehash, 0xff, sizeof(visplanehash));
+
+    for (ev = planeevents ; ev < planeevents + numplaneevents ; ev++)
+    {
+	switch (ev->op)
+	{
+	  case PLANE_CLEAR:
+	    count = 0;
+	    if (hashed)
+		memset (visplanehash, 0xff, sizeof(visplanehash));
+	    break;
+
+	  case PLANE_SPLIT:
+	    planes[count].height = ev->height;
+	    planes[count].picnum = ev->picnum;
+	    planes[count].lightlevel = ev->lightlevel;
+	    count++;
+	    break;
+
+	  case PLANE_FIND:
+	    hash = visplane_hash (ev->height, ev->picnum, ev->lightlevel);
+	    check = NULL;
+
+	    if (hashed)
+	    {
+		for (i = visplanehash[hash] ; i != -1 ; i = planes[i].next)
+		{
+		    if (ev->height == planes[i].height
+			&& ev->picnum == planes[i].picnum
+			&& ev->lightlevel == planes[i].lightlevel)
+		    {
+			check = &planes[i];
+			break;
+		    }
+		}
+	    }
+	    else
+	    {
+		for (i = 0 ; i < count ; i++)
+		{
+		    if (ev->height == planes[i].height
+			&& ev->picnum == planes[i].picnum
+			&& ev->lightlevel == planes[i].lightlevel)
+		    {
+			check = &planes[i];
+			break;
+		    }
+		}
+	    }
+
+	    if (!check)
+	    {
+		check = &planes[count++];
+		check->height = ev->height;
+		check->picnum = ev->picnum;
+		check->lightlevel = ev->lightlevel;
+		check->next = visplanehash[hash];
+		visplanehash[hash] = check - planes;
+	    }
+
+	    sum = sum * 31 + (check - planes);
+	    break;
+	}
+    }
+
+    return sum;
+}
+
+
+static double R_PlaneTimeUS (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+
+//
+// R_PlaneBenchmark
+// Times finding the visplanes of every frame recorded, best of a
+// few runs each way.
+//
+static void R_PlaneBenchmark (void)
+{
+    visplane_t*		planes;
+    planeevent_t*	ev;
+    int			frames = 0;
+    int			lookups = 0;
+    int			created = 0;
+    int			run;
+    unsigned int	sums[2];
+    double		best[2];
+
+    if (!numplaneevents)
+	return;
+
+    for (ev = planeevents ; ev < planeevents + numplaneevents ; ev++)
+    {
+	frames += ev->op == PLANE_CLEAR;
+	lookups += ev->op == PLANE_FIND;
+	created += ev->op != PLANE_CLEAR;
+    }
+
+    // At most one new visplane per event
+    planes = malloc (numplaneevents * sizeof(*planes));
+
+    if (!planes)
+	return;
+
+    for (run = 0 ; run < 5 ; run++)
+    {
+	int	hashed;
+
+	for (hashed = 0 ; hashed < 2 ; hashed++)
+	{
+	    double	start = R_PlaneTimeUS ();
+	    double	us;
+
+	    sums[hashed] = R_ReplayPlanes (planes, hashed);
+	    us = R_PlaneTimeUS () - start;
+
+	    if (run == 0 || us < best[hashed])
+		best[hashed] = us;
+	}
+    }
+
+    printf ("R_FindPlane: %i lookups in %i frames, %.1f visplanes each: "
+	    "%.1f ns per lookup scanning, %.1f ns hashed%s\n",
+	    lookups, frames, (double) created / (frames ? frames : 1),
+	    best[0] * 1000 / lookups, best[1] * 1000 / lookups,
+	    sums[0] != sums[1] ? ", FOUND DIFFERENT VISPLANES" : "");
+
+    free (planes);
+}
+
+
+//
+// R_PrintLimits
+// The high water marks of the map being left.
+//
+static void R_PrintLimits (void)
+{
+    char	name[9];
+
+    if (!highwater.frames)
+	return;
+
+    if (gamemode == commercial)
+	M_snprintf (name, sizeof(name), "MAP%02i", highwater.map);
+    else
+	M_snprintf (name, sizeof(name), "E%iM%i", highwater.episode, highwater.map);
+
+    printf ("R_DrawPlanes: %s, %i frames: at most %i of %i visplanes, "
+	    "%i of %i drawsegs, %i of %i openings\n",
+	    name, highwater.frames, highwater.visplanes, MAXVISPLANES,
+	    highwater.drawsegs, MAXDRAWSEGS, highwater.openings, MAXOPENINGS);
+}
+
+
+static void R_CountLimits (void)
+{
+    if (highwater.episode != gameepisode || highwater.map != gamemap)
+    {
+	R_PrintLimits ();
+	memset (&highwater, 0, sizeof(highwater));
+	highwater.episode = gameepisode;
+	highwater.map = gamemap;
+    }
+
+    highwater.frames++;
+
+    if (lastvisplane - visplanes > highwater.visplanes)
+	highwater.visplanes = lastvisplane - visplanes;
+    if (ds_p - drawsegs > highwater.drawsegs)
+	highwater.drawsegs = ds_p - drawsegs;
+    if (lastopening - openings > highwater.openings)
+	highwater.openings = lastopening - openings;
+}
+
+
 //
 // R_InitPlanes
 // Only at game startup.
 //
 void R_InitPlanes (void)
 {
-  // Doh!
+    numvisplanes = MAXVISPLANES;
+    numopenings = MAXOPENINGS;
+
+    // Vanilla only finds the openings overflowed at the end of the
+    // frame. Leave room past the limit for the wall that does it,
+    // so R_StoreWallRange can stop before the next one.
+    visplanes = malloc (numvisplanes * sizeof(*visplanes));
+    openings = malloc ((numopenings + 3*SCREENWIDTH) * sizeof(*openings));
+
+    if (!visplanes || !openings)
+	I_Error ("R_InitPlanes: couldn't allocate visplanes");
+
+    //!
+    // @category obscure
+    //
+    // Print the most visplanes, drawsegs and openings used in a frame
+    // of each map, against the vanilla limits.
+    //
+
+    if (M_ParmExists ("-limitstats"))
+    {
+	limitstats = true;
+	I_AtExit (R_PrintLimits, true);
+    }
+
+    //!
+    // @category obscure
+    //
+    // Record the visplane lookups of the game, and time them on exit
+    // hashed and with the linear scan vanilla used.
+    //
+
+    if (M_ParmExists ("-planebench"))
+    {
+	R_RecordPlane (PLANE_CLEAR, 0, 0, 0);
+	I_AtExit (R_PlaneBenchmark, true);
+    }
+}
+
+
+//
+// R_GrowOpenings
+// Makes room for needed more openings, with -nolimits. The
+// drawsegs so far point into them, so are moved along.
+//
+static short* R_MoveOpenings (short* p, int x1, short* old, int used)
+{
+    if (p && p + x1 >= old && p + x1 < old + used)
+	return openings + (p + x1 - old) - x1;
+
+    return p;
+}
+
+void R_GrowOpenings (int needed)
+{
+    int		used = lastopening - openings;
+    short*	old = openings;
+    drawseg_t*	ds;
+
+    while (numopenings < used + needed)
+	numopenings *= 2;
+
+    openings = malloc (numopenings * sizeof(*openings));
+
+    if (!openings)
+	I_Error ("R_GrowOpenings: couldn't allocate %i openings", numopenings);
+
+    memcpy (openings, old, used * sizeof(*openings));
+
+    for (ds = drawsegs ; ds < ds_p ; ds++)
+    {
+	ds->maskedtexturecol = R_MoveOpenings (ds->maskedtexturecol, ds->x1, old, used);
+	ds->sprtopclip = R_MoveOpenings (ds->sprtopclip, ds->x1, old, used);
+	ds->sprbottomclip = R_MoveOpenings (ds->sprbottomclip, ds->x1, old, used);
+    }
+
+    lastopening = openings + used;
+    free (old);
+}
+
+
+//
+// R_NewVisplane
+// With -nolimits, makes more when they run out, moving
+// floorplane and ceilingplane along with them.
+//
+static visplane_t* R_NewVisplane (void)
+{
+    visplane_t*	old = visplanes;
+
+    if (lastvisplane - visplanes == numvisplanes)
+    {
+	if (!limitremoving)
+	    I_Error ("R_FindPlane: no more visplanes");
+
+	visplanes = malloc (numvisplanes * 2 * sizeof(*visplanes));
+
+	if (!visplanes)
+	    I_Error ("R_NewVisplane: couldn't allocate %i visplanes",
+		     numvisplanes * 2);
+
+	memcpy (visplanes, old, numvisplanes * sizeof(*visplanes));
+	lastvisplane = visplanes + numvisplanes;
+	numvisplanes *= 2;
+
+	if (floorplane)
+	    floorplane = visplanes + (floorplane - old);
+	if (ceilingplane)
+	    ceilingplane = visplanes + (ceilingplane - old);
+
+	free (old);
+    }
+
+    return lastvisplane++;
 }
 
 
@@ -189,6 +577,10 @@ void R_ClearPlanes (void)
 
     lastvisplane = visplanes;
     lastopening = openings;
+    memset (visplanehash, 0xff, sizeof(visplanehash));
+
+    if (planeevents)
+	R_RecordPlane (PLANE_CLEAR, 0, 0, 0);
     
     // texture calculation
     memset (cachedheight, 0, sizeof(cachedheight));
@@ -214,31 +606,35 @@ R_FindPlane
   int		lightlevel )
 {
     visplane_t*	check;
+    unsigned int	hash;
+    int		i;
 	
     if (picnum == skyflatnum)
     {
 	height = 0;			// all skys map together
 	lightlevel = 0;
     }
+
+    if (planeevents)
+	R_RecordPlane (PLANE_FIND, height, picnum, lightlevel);
+
+    hash = visplane_hash (height, picnum, lightlevel);
 	
-    for (check=visplanes; check<lastvisplane; check++)
+    for (i=visplanehash[hash] ; i != -1 ; i=check->next)
     {
+	check = &visplanes[i];
+
 	if (height == check->height
 	    && picnum == check->picnum
 	    && lightlevel == check->lightlevel)
 	{
-	    break;
+	    return check;
 	}
     }
-    
-			
-    if (check < lastvisplane)
-	return check;
 		
-    if (lastvisplane - visplanes == MAXVISPLANES)
-	I_Error ("R_FindPlane: no more visplanes");
-		
-    lastvisplane++;
+    check = R_NewVisplane ();
+    check->next = visplanehash[hash];
+    visplanehash[hash] = check - visplanes;
 
     check->height = height;
     check->picnum = picnum;
@@ -303,11 +699,15 @@ R_CheckPlane
     }
 	
     // make a new visplane
-    lastvisplane->height = pl->height;
-    lastvisplane->picnum = pl->picnum;
-    lastvisplane->lightlevel = pl->lightlevel;
+    if (planeevents)
+	R_RecordPlane (PLANE_SPLIT, pl->height, pl->picnum, pl->lightlevel);
+
+    x = pl - visplanes;
+    pl = R_NewVisplane ();
+    pl->height = visplanes[x].height;
+    pl->picnum = visplanes[x].picnum;
+    pl->lightlevel = visplanes[x].lightlevel;
     
-    pl = lastvisplane++;
     pl->minx = start;
     pl->maxx = stop;
 
@@ -367,19 +767,22 @@ void R_DrawPlanes (void)
     int                 lumpnum;
 				
 #ifdef RANGECHECK
-    if (ds_p - drawsegs > MAXDRAWSEGS)
+    if (ds_p - drawsegs > numdrawsegs)
 	I_Error ("R_DrawPlanes: drawsegs overflow (%i)",
 		 ds_p - drawsegs);
     
-    if (lastvisplane - visplanes > MAXVISPLANES)
+    if (lastvisplane - visplanes > numvisplanes)
 	I_Error ("R_DrawPlanes: visplane overflow (%i)",
 		 lastvisplane - visplanes);
     
-    if (lastopening - openings > MAXOPENINGS)
+    if (lastopening - openings > numopenings)
 	I_Error ("R_DrawPlanes: opening overflow (%i)",
 		 lastopening - openings);
 #endif
 
+    if (limitstats)
+	R_CountLimits ();
+
     for (pl = visplanes ; pl < lastvisplane ; pl++)
     {
 	if (pl->minx > pl->maxx)
@@ -26,7 +26,9 @@
 
 
 // Visplane related.
+extern  short*		openings;
 extern  short*		lastopening;
+extern  int		numopenings;
 
 
 typedef void (*planefunction_t) (int top, int bottom);
@@ -41,6 +43,7 @@ extern fixed_t		yslope[SCREENHEIGHT];
 extern fixed_t		distscale[SCREENWIDTH];
 
 void R_InitPlanes (void);
+void R_GrowOpenings (int needed);
 void R_ClearPlanes (void);
 
 void
@@ -380,8 +380,24 @@ R_StoreWallRange
     int			lightnum;
 
     // don't overflow and crash
-    if (ds_p == &drawsegs[MAXDRAWSEGS])
-	return;		
+    if (ds_p == &drawsegs[numdrawsegs])
+    {
+	if (!limitremoving)
+	    return;
+
+	R_GrowDrawSegs ();
+    }
+
+    // This wall takes at most three columns of openings: masked
+    // texture columns, and the top and bottom sprite clips.
+    if (lastopening - openings + 3*(stop-start+1) > numopenings)
+    {
+	if (limitremoving)
+	    R_GrowOpenings (3*(stop-start+1));
+	else if (lastopening - openings > numopenings)
+	    I_Error ("R_StoreWallRange: opening overflow (%i)",
+		     lastopening - openings);
+    }
 		
 #ifdef RANGECHECK
     if (start >=viewwidth || start > stop)
@@ -0,0 +1,380 @@
+//
+// Strip-parallel drawing, see r_strips.h.
+//
+// Queued draws go into chunks that never move once written, so the
+// workers can read them while the main thread adds more. Everything
+// queued so far is handed over each time a chunk fills, and the main
+// thread only waits at the end of the frame. Columns belong to the one
+// worker whose strip they are in. Spans cross strips, so each worker
+// draws its own part of them, starting the texture where a whole span
+// would have got to.
+//
+// The fuzz effect reads the pixels above and below in the same column,
+// which the worker drawing the column has already drawn, and steps
+// through its pattern across columns, so where each fuzz column starts
+// in the pattern is worked out as it is queued.
+//
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "doomdef.h"
+#include "i_system.h"
+#include "m_argv.h"
+
+#include "r_local.h"
+#include "r_strips.h"
+
+#define MAXRENDERTHREADS	8
+#define DRAWCHUNK		256	// draws
+#define MAXDRAWCHUNKS		1024
+
+typedef struct
+{
+    void		(*draw) (void);
+    lighttable_t*	colormap;
+    byte*		source;
+    byte*		translation;
+    int			x1;		// the same for columns
+    int			x2;
+    int			y1;		// the same for spans
+    int			y2;
+    fixed_t		frac;		// texturemid, or xfrac
+    fixed_t		yfrac;
+    fixed_t		step;		// iscale, or xstep
+    fixed_t		ystep;
+    int			fuzzpos;
+    boolean		span;
+} stripdraw_t;
+
+typedef struct
+{
+    pthread_t		thread;
+    int			index;
+    int			done;		// draws finished this frame
+} stripworker_t;
+
+static stripworker_t	workers[MAXRENDERTHREADS];
+static int		numworkers;	// started
+static int		activeworkers;	// drawing the view
+
+static stripdraw_t*	chunks[MAXDRAWCHUNKS];
+static int		numdraws;	// queued, by the main thread
+static int		published;	// handed to the workers
+
+static pthread_mutex_t	strip_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	done_cond = PTHREAD_COND_INITIALIZER;
+
+// What R_ExecuteSetViewSize picked, for the workers to call
+static void		(*drawcolumn) (void);
+static void		(*drawfuzzcolumn) (void);
+static void		(*drawtranscolumn) (void);
+static void		(*drawspan) (void);
+
+
+
+//
+// R_DrawStrip
+// Draws the part of draws start to end in columns x1 to x2.
+//
+static void R_DrawStrip (int start, int end, int x1, int x2)
+{
+    stripdraw_t*	d;
+    int			i;
+
+    for (i=start ; i<end ; i++)
+    {
+	d = &chunks[i / DRAWCHUNK][i % DRAWCHUNK];
+
+	if (d->x2 < x1 || d->x1 > x2)
+	    continue;
+
+	if (d->span)
+	{
+	    ds_y = d->y1;
+	    ds_x1 = d->x1;
+	    ds_x2 = d->x2 < x2 ? d->x2 : x2;
+	    ds_colormap = d->colormap;
+	    ds_source = d->source;
+	    ds_xfrac = d->frac;
+	    ds_yfrac = d->yfrac;
+	    ds_xstep = d->step;
+	    ds_ystep = d->ystep;
+
+	    if (ds_x1 < x1)
+	    {
+		R_AdvanceSpan (x1 - ds_x1);
+		ds_x1 = x1;
+	    }
+	}
+	else
+	{
+	    dc_x = d->x1;
+	    dc_yl = d->y1;
+	    dc_yh = d->y2;
+	    dc_colormap = d->colormap;
+	    dc_source = d->source;
+	    dc_translation = d->translation;
+	    dc_texturemid = d->frac;
+	    dc_iscale = d->step;
+	    fuzzpos = d->fuzzpos;
+	}
+
+	d->draw ();
+    }
+}
+
+
+static void* R_StripWorker (void* arg)
+{
+    stripworker_t*	w = arg;
+    int			start, end;
+    int			x1, x2;
+
+    pthread_mutex_lock (&strip_lock);
+
+    for (;;)
+    {
+	while (w->index >= activeworkers || w->done == published)
+	    pthread_cond_wait (&work_cond, &strip_lock);
+
+	start = w->done;
+	end = published;
+	x1 = viewwidth * w->index / activeworkers;
+	x2 = viewwidth * (w->index+1) / activeworkers - 1;
+
+	pthread_mutex_unlock (&strip_lock);
+	R_DrawStrip (start, end, x1, x2);
+	pthread_mutex_lock (&strip_lock);
+
+	w->done = end;
+	pthread_cond_signal (&done_cond);
+    }
+
+    return NULL;
+}
+
+
+
+//
+// Queueing
+//
+static stripdraw_t* R_NewStripDraw (void)
+{
+    int		chunk = numdraws / DRAWCHUNK;
+
+    if (chunk == MAXDRAWCHUNKS)
+    {
+	R_FlushStrips ();
+	chunk = 0;
+    }
+
+    if (!chunks[chunk])
+    {
+	chunks[chunk] = malloc (DRAWCHUNK * sizeof(stripdraw_t));
+
+	if (!chunks[chunk])
+	    I_Error ("R_NewStripDraw: couldn't allocate draws");
+    }
+
+    return &chunks[chunk][numdraws % DRAWCHUNK];
+}
+
+
+static void R_QueueStripDraw (void)
+{
+    numdraws++;
+
+    if (numdraws % DRAWCHUNK == 0)
+    {
+	pthread_mutex_lock (&strip_lock);
+	published = numdraws;
+	pthread_cond_broadcast (&work_cond);
+	pthread_mutex_unlock (&strip_lock);
+    }
+}
+
+
+static void R_QueueColumnWith (void (*draw) (void))
+{
+    stripdraw_t*	d = R_NewStripDraw ();
+
+    d->draw = draw;
+    d->colormap = dc_colormap;
+    d->source = dc_source;
+    d->translation = dc_translation;
+    d->x1 = d->x2 = dc_x;
+    d->y1 = dc_yl;
+    d->y2 = dc_yh;
+    d->frac = dc_texturemid;
+    d->step = dc_iscale;
+    d->fuzzpos = fuzzpos;
+    d->span = false;
+
+    R_QueueStripDraw ();
+}
+
+
+static void R_QueueColumn (void)
+{
+    if (dc_yl <= dc_yh)
+	R_QueueColumnWith (drawcolumn);
+}
+
+
+static void R_QueueFuzzColumn (void)
+{
+    if (dc_yl <= dc_yh)
+    {
+	R_QueueColumnWith (drawfuzzcolumn);
+	R_SkipFuzzColumn ();
+    }
+}
+
+
+static void R_QueueTranslatedColumn (void)
+{
+    if (dc_yl <= dc_yh)
+	R_QueueColumnWith (drawtranscolumn);
+}
+
+
+static void R_QueueSpan (void)
+{
+    stripdraw_t*	d = R_NewStripDraw ();
+
+    d->draw = drawspan;
+    d->colormap = ds_colormap;
+    d->source = ds_source;
+    d->x1 = ds_x1;
+    d->x2 = ds_x2;
+    d->y1 = d->y2 = ds_y;
+    d->frac = ds_xfrac;
+    d->yfrac = ds_yfrac;
+    d->step = ds_xstep;
+    d->ystep = ds_ystep;
+    d->span = true;
+
+    R_QueueStripDraw ();
+}
+
+
+
+//
+// R_FlushStrips
+//
+void R_FlushStrips (void)
+{
+    int		i;
+
+    if (!numdraws)
+	return;
+
+    pthread_mutex_lock (&strip_lock);
+
+    published = numdraws;
+    pthread_cond_broadcast (&work_cond);
+
+    for (i=0 ; i<activeworkers ; i++)
+	while (workers[i].done != published)
+	    pthread_cond_wait (&done_cond, &strip_lock);
+
+    for (i=0 ; i<activeworkers ; i++)
+	workers[i].done = 0;
+
+    published = numdraws = 0;
+
+    pthread_mutex_unlock (&strip_lock);
+}
+
+
+static void R_ApplyStripFuncs (void)
+{
+    // Not picked yet
+    if (!drawcolumn)
+	return;
+
+    if (activeworkers)
+    {
+	colfunc = basecolfunc = R_QueueColumn;
+	fuzzcolfunc = R_QueueFuzzColumn;
+	transcolfunc = R_QueueTranslatedColumn;
+	spanfunc = R_QueueSpan;
+    }
+    else
+    {
+	colfunc = basecolfunc = drawcolumn;
+	fuzzcolfunc = drawfuzzcolumn;
+	transcolfunc = drawtranscolumn;
+	spanfunc = drawspan;
+    }
+}
+
+
+void R_SetStripFuncs (void)
+{
+    drawcolumn = basecolfunc;
+    drawfuzzcolumn = fuzzcolfunc;
+    drawtranscolumn = transcolfunc;
+    drawspan = spanfunc;
+
+    R_ApplyStripFuncs ();
+}
+
+
+void R_SetRenderThreads (int threads)
+{
+    if (threads < 0)
+	threads = 0;
+    if (threads > MAXRENDERTHREADS)
+	threads = MAXRENDERTHREADS;
+
+    R_FlushStrips ();
+
+    pthread_mutex_lock (&strip_lock);
+
+    while (numworkers < threads)
+    {
+	stripworker_t*	w = &workers[numworkers];
+
+	w->index = numworkers;
+	w->done = 0;
+
+	if (pthread_create (&w->thread, NULL, R_StripWorker, w) != 0)
+	    I_Error ("R_SetRenderThreads: couldn't start a render thread");
+
+	numworkers++;
+    }
+
+    activeworkers = threads;
+
+    pthread_mutex_unlock (&strip_lock);
+
+    R_ApplyStripFuncs ();
+}
+
+
+int R_GetRenderThreads (void)
+{
+    return activeworkers;
+}
+
+
+void R_InitStrips (void)
+{
+    int		i;
+
+    //!
+    // @arg <n>
+    //
+    // Draw the view with n render threads, each filling a vertical
+    // strip of it, while the main thread walks the BSP. 0, the
+    // default, draws everything on the main thread.
+    //
+
+    i = M_CheckParmWithArgs ("-renderthreads", 1);
+    if (i > 0)
+	R_SetRenderThreads (atoi (myargv[i+1]));
+}
@@ -0,0 +1,33 @@
+//
+// Strip-parallel drawing of the view, with RENDER_THREADS.
+//
+// The main thread walks the BSP and works out every column and span
+// as before, but only queues them. Worker threads each take a
+// vertical strip of the view and draw, in order, the part of every
+// queued column and span that falls in it, while the main thread goes
+// on to the next. No pixel is drawn by two workers, and each one's
+// pixels are drawn in the same order as on a single thread, so the
+// view comes out the same.
+//
+
+#ifndef __R_STRIPS__
+#define __R_STRIPS__
+
+// At startup: the worker threads for -renderthreads
+void R_InitStrips (void);
+
+// Draw with this many workers from the next frame, 0 for the main
+// thread alone
+void R_SetRenderThreads (int threads);
+int R_GetRenderThreads (void);
+
+// After R_ExecuteSetViewSize has picked the drawing functions: queue
+// calls to them instead, if there are workers
+void R_SetStripFuncs (void);
+
+// Wait until everything queued so far has been drawn. At the end of
+// the frame, and before the zone changes any of its memory, which
+// queued columns may be drawn from or read past the end of.
+void R_FlushStrips (void);
+
+#endif
@@ -21,6 +21,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 
 #include "deh_main.h"
@@ -34,6 +35,7 @@
 #include "r_local.h"
 
 #include "doomstat.h"
+#include "m_argv.h"
 
 
 
@@ -278,10 +280,65 @@ void R_InitSpriteDefs (char** namelist)
 //
 // GAME FUNCTIONS
 //
-vissprite_t	vissprites[MAXVISSPRITES];
+
+// The vissprites of a frame, in the order they were projected. The
+// array starts with room for MAXVISSPRITES and doubles whenever a frame
+// needs more, so crowded maps no longer lose sprites past the limit.
+vissprite_t*	vissprites;
 vissprite_t*	vissprite_p;
 int		newvissprite;
 
+static int		numvissprites;
+
+// For R_SortVisSprites, as big as vissprites
+static vissprite_t**	vissprite_order;
+static vissprite_t**	vissprite_merge;
+
+// -spritestats
+static boolean		sprite_stats;
+static struct
+{
+    unsigned int	frames;
+    unsigned long long	sprites;
+    int			max_sprites;
+    double		sort_us;
+    double		max_sort_us;
+} vsprstats;
+
+
+static void R_AllocVisSprites (int count)
+{
+    vissprites = realloc (vissprites, count * sizeof(*vissprites));
+    vissprite_order = realloc (vissprite_order, count * sizeof(*vissprite_order));
+    vissprite_merge = realloc (vissprite_merge, count * sizeof(*vissprite_merge));
+
+    if (!vissprites || !vissprite_order || !vissprite_merge)
+	I_Error ("R_AllocVisSprites: couldn't allocate %i vissprites", count);
+
+    numvissprites = count;
+}
+
+
+static double R_SpriteTimeUS (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+
+static void R_PrintSpriteStats (void)
+{
+    if (!vsprstats.frames)
+	return;
+
+    printf ("R_DrawMasked: %u frames, %.1f sprites per frame (max %i), "
+	    "sorted in %.1f us per frame (max %.1f us), room for %i\n",
+	    vsprstats.frames, (double) vsprstats.sprites / vsprstats.frames,
+	    vsprstats.max_sprites, vsprstats.sort_us / vsprstats.frames,
+	    vsprstats.max_sort_us, numvissprites);
+}
+
 
 
 //
@@ -298,6 +355,21 @@ void R_InitSprites (char** namelist)
     }
 	
     R_InitSpriteDefs (namelist);
+    R_AllocVisSprites (MAXVISSPRITES);
+    vissprite_p = vissprites;
+
+    //!
+    // @category obscure
+    //
+    // Print how many sprites were drawn per frame, and how long it
+    // took to sort them, on exit.
+    //
+
+    if (M_ParmExists ("-spritestats"))
+    {
+	sprite_stats = true;
+	I_AtExit (R_PrintSpriteStats, true);
+    }
 }
 
 
@@ -314,13 +386,16 @@ void R_ClearSprites (void)
 
 //
 // R_NewVisSprite
+// The array may move when it grows, so only the sprite
+// being projected can be held on to.
 //
-vissprite_t	overflowsprite;
-
 vissprite_t* R_NewVisSprite (void)
 {
-    if (vissprite_p == &vissprites[MAXVISSPRITES])
-	return &overflowsprite;
+    if (vissprite_p == &vissprites[numvissprites])
+    {
+	R_AllocVisSprites (numvissprites * 2);
+	vissprite_p = &vissprites[numvissprites / 2];
+    }
     
     vissprite_p++;
     return vissprite_p-1;
@@ -405,6 +480,7 @@ R_DrawVisSprite
     {
 	// NULL colormap = shadow draw
 	colfunc = fuzzcolfunc;
+	fuzzdrawn = true;
     }
     else if (vis->mobjflags & MF_TRANSLATION)
     {
@@ -772,6 +848,9 @@ void R_DrawPlayerSprites (void)
 
 //
 // R_SortVisSprites
+// Links the vissprites into vsprsortedhead from the smallest scale
+// (farthest) to the largest. Sprites of equal scale keep the order
+// they were projected in.
 //
 vissprite_t	vsprsortedhead;
 
@@ -780,50 +859,75 @@ void R_SortVisSprites (void)
 {
     int			i;
     int			count;
+    int			width;
+    vissprite_t**	src;
+    vissprite_t**	dest;
+    vissprite_t**	swap;
     vissprite_t*	ds;
-    vissprite_t*	best;
-    vissprite_t		unsorted;
-    fixed_t		bestscale;
+    double		start = 0;
 
     count = vissprite_p - vissprites;
-	
-    unsorted.next = unsorted.prev = &unsorted;
 
-    if (!count)
-	return;
-		
-    for (ds=vissprites ; ds<vissprite_p ; ds++)
-    {
-	ds->next = ds+1;
-	ds->prev = ds-1;
-    }
-    
-    vissprites[0].prev = &unsorted;
-    unsorted.next = &vissprites[0];
-    (vissprite_p-1)->next = &unsorted;
-    unsorted.prev = vissprite_p-1;
-    
-    // pull the vissprites out by scale
+    if (sprite_stats)
+	start = R_SpriteTimeUS ();
 
     vsprsortedhead.next = vsprsortedhead.prev = &vsprsortedhead;
+
+    if (!count)
+	goto done;
+
+    src = vissprite_order;
+    dest = vissprite_merge;
+
     for (i=0 ; i<count ; i++)
+	src[i] = &vissprites[i];
+
+    // bottom up merge sort, taking from the left run on ties
+    for (width=1 ; width<count ; width*=2)
     {
-	bestscale = INT_MAX;
-        best = unsorted.next;
-	for (ds=unsorted.next ; ds!= &unsorted ; ds=ds->next)
+	for (i=0 ; i<count ; i+=2*width)
 	{
-	    if (ds->scale < bestscale)
-	    {
-		bestscale = ds->scale;
-		best = ds;
-	    }
+	    int l = i;
+	    int mid = i+width < count ? i+width : count;
+	    int r = mid;
+	    int end = i+2*width < count ? i+2*width : count;
+	    int d = i;
+
+	    while (l < mid && r < end)
+		dest[d++] = src[r]->scale < src[l]->scale ? src[r++] : src[l++];
+	    while (l < mid)
+		dest[d++] = src[l++];
+	    while (r < end)
+		dest[d++] = src[r++];
 	}
-	best->next->prev = best->prev;
-	best->prev->next = best->next;
-	best->next = &vsprsortedhead;
-	best->prev = vsprsortedhead.prev;
-	vsprsortedhead.prev->next = best;
-	vsprsortedhead.prev = best;
+
+	swap = src;
+	src = dest;
+	dest = swap;
+    }
+
+    for (i=0 ; i<count ; i++)
+    {
+	ds = src[i];
+	ds->next = &vsprsortedhead;
+	ds->prev = vsprsortedhead.prev;
+	vsprsortedhead.prev->next = ds;
+	vsprsortedhead.prev = ds;
+    }
+
+done:
+    if (sprite_stats)
+    {
+	double us = R_SpriteTimeUS () - start;
+
+	vsprstats.frames++;
+	vsprstats.sprites += count;
+	vsprstats.sort_us += us;
+
+	if (count > vsprstats.max_sprites)
+	    vsprstats.max_sprites = count;
+	if (us > vsprstats.max_sort_us)
+	    vsprstats.max_sort_us = us;
     }
 }
 
@@ -91,19 +91,40 @@ void V_CopyRect(int srcx, int srcy, byte *source,
  
 #ifdef RANGECHECK 
     if (srcx < 0
-     || srcx + width > SCREENWIDTH
+     || srcx + width > ORIGWIDTH
      || srcy < 0
-     || srcy + height > SCREENHEIGHT 
+     || srcy + height > ORIGHEIGHT 
      || destx < 0
-     || destx + width > SCREENWIDTH
+     || destx + width > ORIGWIDTH
      || desty < 0
-     || desty + height > SCREENHEIGHT)
+     || desty + height > ORIGHEIGHT)
     {
         I_Error ("Bad V_CopyRect");
     }
 #endif 
 
     V_MarkRect(destx, desty, width, height); 
+
+#ifdef SCREEN_SCALED
+    // The rectangle is given in 320x200 coordinates.  Size it from the
+    // destination so it covers the same pixels V_DrawPatch would.
+    {
+        int w = TOSCREENX(destx + width) - TOSCREENX(destx);
+        int h = TOSCREENY(desty + height) - TOSCREENY(desty);
+
+        if (TOSCREENY(srcy + height) - TOSCREENY(srcy) < h)
+        {
+            h = TOSCREENY(srcy + height) - TOSCREENY(srcy);
+        }
+
+        srcx = TOSCREENX(srcx);
+        srcy = TOSCREENY(srcy);
+        destx = TOSCREENX(destx);
+        desty = TOSCREENY(desty);
+        width = w;
+        height = h;
+    }
+#endif
  
     src = source + SCREENWIDTH * srcy + srcx; 
     dest = dest_screen + SCREENWIDTH * desty + destx; 
@@ -131,6 +152,61 @@ void V_SetPatchClipCallback(vpatchclipfunc_t func)
     patchclip_callback = func;
 }
 
+#ifdef SCREEN_SCALED
+
+//
+// V_DrawPatchScaled
+// Draws a patch positioned in 320x200 coordinates to a screen of a
+// different size, taking the nearest source pixel for each screen pixel.
+//
+
+static void V_DrawPatchScaled(int x, int y, patch_t *patch, boolean flipped)
+{
+    int count;
+    int col;
+    column_t *column;
+    byte *dest;
+    byte *source;
+    int w;
+    int sx, sx2;
+    int sy, sy2;
+    int top;
+
+    w = SHORT(patch->width);
+    sx2 = TOSCREENX(x + w);
+
+    for (sx = TOSCREENX(x); sx < sx2; sx++)
+    {
+        col = FROMSCREENX(sx) - x;
+
+        if (flipped)
+        {
+            col = w - 1 - col;
+        }
+
+        column = (column_t *)((byte *)patch + LONG(patch->columnofs[col]));
+
+        // step through the posts in a column
+        while (column->topdelta != 0xff)
+        {
+            source = (byte *)column + 3;
+            top = y + column->topdelta;
+            sy = TOSCREENY(top);
+            sy2 = TOSCREENY(top + column->length);
+            dest = dest_screen + sy * SCREENWIDTH + sx;
+
+            for (count = sy2 - sy; count > 0; count--, sy++)
+            {
+                *dest = source[FROMSCREENY(sy) - top];
+                dest += SCREENWIDTH;
+            }
+            column = (column_t *)((byte *)column + column->length + 4);
+        }
+    }
+}
+
+#endif
+
 //
 // V_DrawPatch
 // Masks a column based masked pic to the screen. 
@@ -158,9 +234,9 @@ void V_DrawPatch(int x, int y, patch_t *patch)
 
 #ifdef RANGECHECK
     if (x < 0
-     || x + SHORT(patch->width) > SCREENWIDTH
+     || x + SHORT(patch->width) > ORIGWIDTH
      || y < 0
-     || y + SHORT(patch->height) > SCREENHEIGHT)
+     || y + SHORT(patch->height) > ORIGHEIGHT)
     {
         I_Error("Bad V_DrawPatch x=%i y=%i patch.width=%i patch.height=%i topoffset=%i leftoffset=%i", x, y, patch->width, patch->height, patch->topoffset, patch->leftoffset);
     }
@@ -168,6 +244,11 @@ void V_DrawPatch(int x, int y, patch_t *patch)
 
     V_MarkRect(x, y, SHORT(patch->width), SHORT(patch->height));
 
+#ifdef SCREEN_SCALED
+    V_DrawPatchScaled(x, y, patch, false);
+    return;
+#endif
+
     col = 0;
     desttop = dest_screen + y * SCREENWIDTH + x;
 
@@ -222,9 +303,9 @@ void V_DrawPatchFlipped(int x, int y, patch_t *patch)
 
 #ifdef RANGECHECK 
     if (x < 0
-     || x + SHORT(patch->width) > SCREENWIDTH
+     || x + SHORT(patch->width) > ORIGWIDTH
      || y < 0
-     || y + SHORT(patch->height) > SCREENHEIGHT)
+     || y + SHORT(patch->height) > ORIGHEIGHT)
     {
         I_Error("Bad V_DrawPatchFlipped");
     }
@@ -232,6 +313,11 @@ void V_DrawPatchFlipped(int x, int y, patch_t *patch)
 
     V_MarkRect (x, y, SHORT(patch->width), SHORT(patch->height));
 
+#ifdef SCREEN_SCALED
+    V_DrawPatchScaled(x, y, patch, true);
+    return;
+#endif
+
     col = 0;
     desttop = dest_screen + y * SCREENWIDTH + x;
 
@@ -0,0 +1,167 @@
+//
+// Publishes frames into a shared memory ring for other processes on the
+// robot, see vector_export.h for the layout and the reader's side.
+//
+// This runs on the game thread, straight from DG_DrawFrame: a frame is
+// one copy (or palette lookup) into the next slot and never waits on
+// anything, whatever the readers are doing.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "doomgeneric.h"
+#include "doomstat.h"
+#include "i_video.h"
+#include "vector_export.h"
+
+static ve_header_t* export_ring = NULL;
+static size_t export_size;
+static uint32_t export_frame = 0;
+
+static uint8_t export_rgb[768];
+static uint16_t export_rgb565[256];
+
+typedef struct {
+    unsigned int frames;
+    unsigned long long total_us;
+    unsigned int max_us;
+} export_stats_t;
+
+static export_stats_t export_stats;
+
+static uint32_t export_time_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
+}
+
+static void export_update_palette() {
+    for (int i = 0; i < 256; i++) {
+        export_rgb[i * 3] = colors[i].r;
+        export_rgb[i * 3 + 1] = colors[i].g;
+        export_rgb[i * 3 + 2] = colors[i].b;
+        export_rgb565[i] = ((colors[i].r & 0xF8) << 8) | ((colors[i].g & 0xFC) << 3) | (colors[i].b >> 3);
+    }
+}
+
+void export_init(const char* name, int slots, int format) {
+    int bpp = format == VE_FORMAT_RGB565 ? 2 : 1;
+    size_t slot_size;
+    int fd;
+
+    if (slots < 2 || slots > VE_MAX_SLOTS) {
+        fprintf(stderr, "Export: %d slots, must be 2 to %d\n", slots, VE_MAX_SLOTS);
+        return;
+    }
+
+    // Keep slots cache line aligned
+    slot_size = (sizeof(ve_slot_t) + DOOMGENERIC_RESX * DOOMGENERIC_RESY * bpp + 63) & ~63;
+    export_size = sizeof(ve_header_t) + slot_size * slots;
+
+    fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || ftruncate(fd, export_size) < 0) {
+        fprintf(stderr, "Export: can't create shared memory %s: %s\n", name, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+
+    export_ring = mmap(NULL, export_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (export_ring == MAP_FAILED) {
+        fprintf(stderr, "Export: can't map %s: %s\n", name, strerror(errno));
+        export_ring = NULL;
+        return;
+    }
+
+    // magic goes in last, so readers never see a half set up header
+    memset(export_ring, 0, export_size);
+
+    export_ring->version = VE_VERSION;
+    export_ring->header_size = sizeof(ve_header_t);
+    export_ring->slot_size = slot_size;
+    export_ring->slots = slots;
+    export_ring->width = DOOMGENERIC_RESX;
+    export_ring->height = DOOMGENERIC_RESY;
+    export_ring->format = format;
+    export_ring->writer_pid = getpid();
+    __atomic_store_n(&export_ring->magic, VE_MAGIC, __ATOMIC_RELEASE);
+
+    export_update_palette();
+
+    printf("Export: %d %s frames in shared memory %s\n", slots,
+           format == VE_FORMAT_RGB565 ? "RGB565" : "indexed", name);
+}
+
+void export_submit(boolean new_palette) {
+    const uint8_t* src = (const uint8_t*) DG_ScreenBuffer;
+    uint32_t start, seq, elapsed;
+    ve_slot_t* slot;
+
+    if (export_ring == NULL) {
+        return;
+    }
+
+    start = export_time_us();
+
+    if (new_palette) {
+        export_update_palette();
+    }
+
+    slot = VE_SLOT(export_ring, ++export_frame);
+
+    // Odd while we write, so readers can tell
+    seq = slot->seq;
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->frame = export_frame;
+    slot->tic = gametic;
+    slot->width = DOOMGENERIC_RESX;
+    slot->height = DOOMGENERIC_RESY;
+    slot->format = export_ring->format;
+
+    if (export_ring->format == VE_FORMAT_RGB565) {
+        uint16_t* dst = (uint16_t*) VE_PIXELS(slot);
+
+        slot->pitch = DOOMGENERIC_RESX * 2;
+
+        for (int i = 0; i < DOOMGENERIC_RESX * DOOMGENERIC_RESY; i++) {
+            dst[i] = export_rgb565[src[i]];
+        }
+    } else {
+        slot->pitch = DOOMGENERIC_RESX;
+        memcpy(slot->palette, export_rgb, sizeof(export_rgb));
+        memcpy(VE_PIXELS(slot), src, DOOMGENERIC_RESX * DOOMGENERIC_RESY);
+    }
+
+    slot->time_us = export_time_us();
+
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&export_ring->latest, export_frame, __ATOMIC_RELEASE);
+
+    elapsed = export_time_us() - start;
+    export_stats.frames++;
+    export_stats.total_us += elapsed;
+
+    if (elapsed > export_stats.max_us) {
+        export_stats.max_us = elapsed;
+    }
+}
+
+void export_print_stats(void) {
+    if (export_ring == NULL || export_stats.frames == 0) {
+        return;
+    }
+
+    printf("Export: %u frames, %.1f us average, %u us max\n", export_stats.frames,
+           (double) export_stats.total_us / export_stats.frames, export_stats.max_us);
+}
@@ -0,0 +1,88 @@
+//
+// Frame export to other processes on the robot (-export), through a
+// POSIX shared memory ring. Read by vector_export_reader.c.
+//
+// The object starts with a ve_header_t, followed by slots of slot_size
+// bytes. Frame n goes into slot n % slots. Each slot is guarded by its
+// seq as a seqlock: the writer makes it odd while the slot is being
+// filled and even again afterwards. A reader takes seq (waiting while
+// it is odd), reads the frame in place, and then checks that seq has not
+// changed; if it has, the frame was overwritten under it. The writer
+// never waits for readers, so a slow reader only loses frames.
+//
+// latest is the newest complete frame, 0 before the first. Everything
+// is native-endian.
+//
+
+#ifndef VECTOR_EXPORT_H
+#define VECTOR_EXPORT_H
+
+#include <stdint.h>
+
+#define VE_MAGIC 0x50584744     // "DGXP"
+#define VE_VERSION 1
+
+#define VE_DEFAULT_SLOTS 4
+#define VE_MAX_SLOTS 64
+
+// Pixel formats
+
+enum
+{
+    VE_FORMAT_INDEXED,  // a byte per pixel, palette holds 256 RGB triplets
+    VE_FORMAT_RGB565,   // 16 bits per pixel, palette unused
+};
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;   // sizeof(ve_header_t), where slot 0 starts
+    uint32_t slot_size;     // bytes per slot, including its ve_slot_t
+    uint32_t slots;
+    uint16_t width;
+    uint16_t height;
+    uint32_t format;
+    uint32_t writer_pid;
+    uint32_t latest;
+    uint32_t reserved[8];
+} ve_header_t;
+
+typedef struct
+{
+    uint32_t seq;
+    uint32_t frame;
+    int32_t tic;            // gametic when it was drawn
+    uint32_t time_us;       // CLOCK_MONOTONIC when it was published, in
+                            // microseconds wrapping at 2^32
+    uint16_t width;
+    uint16_t height;
+    uint32_t format;
+    uint32_t pitch;         // bytes per row of pixels
+    uint32_t reserved;
+    uint8_t palette[768];
+    // pixels follow, pitch * height bytes
+} ve_slot_t;
+
+#define VE_SLOT(ring, n) \
+    ((ve_slot_t*) ((uint8_t*) (ring) + (ring)->header_size \
+                   + (size_t) ((n) % (ring)->slots) * (ring)->slot_size))
+
+#define VE_PIXELS(slot) ((uint8_t*) (slot) + sizeof(ve_slot_t))
+
+#ifndef VE_READER
+
+#include "doomtype.h"
+
+// Create the ring in shared memory object name (e.g. "/doom")
+void export_init(const char* name, int slots, int format);
+
+// Publish the frame in DG_ScreenBuffer. new_palette is set if colors
+// changed since the last call.
+void export_submit(boolean new_palette);
+
+void export_print_stats(void);
+
+#endif
+
+#endif
@@ -0,0 +1,224 @@
+//
+// Reads frames from a -export shared memory ring, for testing it and as
+// an example for other consumers. See vector_export.h.
+//
+// make -f Makefile.vector vector-export-reader
+// ./vector-export-reader [-slow <ms>] [-dump <file.ppm>] /name
+//
+// Frames are checksummed where they lie in the ring. -slow holds each
+// one for that long before checking it is still intact, to show what a
+// slow consumer gets: fewer frames, never a stalled game. -dump writes
+// the newest intact frame out as a PPM.
+//
+
+#define VE_READER
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vector_export.h"
+
+static volatile sig_atomic_t running = 1;
+
+typedef struct {
+    unsigned int read;
+    unsigned int missed;        // published while we were busy
+    unsigned int overwritten;   // reused by the writer while we read them
+} reader_stats_t;
+
+static reader_stats_t stats, last_stats;
+
+static void stop(int sig) {
+    (void) sig;
+    running = 0;
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void sleep_ms(double ms) {
+    struct timespec ts;
+    ts.tv_sec = (time_t) (ms / 1000);
+    ts.tv_nsec = (long) ((ms - ts.tv_sec * 1000.0) * 1000000);
+    nanosleep(&ts, NULL);
+}
+
+static uint32_t checksum(const uint8_t* data, size_t size) {
+    uint32_t h = 2166136261u;   // FNV-1a
+
+    for (size_t i = 0; i < size; i++) {
+        h = (h ^ data[i]) * 16777619u;
+    }
+
+    return h;
+}
+
+// Write the slot out as RGB, into a temporary file that only replaces
+// path once the caller knows the frame was intact
+
+static int write_ppm(const char* path, const ve_slot_t* slot) {
+    const uint8_t* pixels = VE_PIXELS(slot);
+    FILE* f = fopen(path, "wb");
+
+    if (f == NULL) {
+        return 0;
+    }
+
+    fprintf(f, "P6\n%d %d\n255\n", slot->width, slot->height);
+
+    for (int y = 0; y < slot->height; y++) {
+        const uint8_t* row = pixels + y * slot->pitch;
+
+        for (int x = 0; x < slot->width; x++) {
+            uint8_t rgb[3];
+
+            if (slot->format == VE_FORMAT_RGB565) {
+                uint16_t c = ((const uint16_t*) row)[x];
+                rgb[0] = (c >> 8) & 0xF8;
+                rgb[1] = (c >> 3) & 0xFC;
+                rgb[2] = (c << 3) & 0xF8;
+            } else {
+                memcpy(rgb, slot->palette + row[x] * 3, 3);
+            }
+
+            fwrite(rgb, 1, 3, f);
+        }
+    }
+
+    return fclose(f) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    const char* name = NULL;
+    const char* dump = NULL;
+    char dump_tmp[4096];
+    double slow = 0, last_print;
+    ve_header_t* ring;
+    struct stat st;
+    uint32_t last = 0;
+    int fd;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-slow") && i + 1 < argc) slow = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-dump") && i + 1 < argc) dump = argv[++i];
+        else name = argv[i];
+    }
+
+    if (name == NULL) {
+        fprintf(stderr, "Usage: %s [-slow <ms>] [-dump <file.ppm>] /name\n", argv[0]);
+        return 1;
+    }
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "Can't open %s: %s\n", name, strerror(errno));
+        return 1;
+    }
+
+    ring = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (ring == MAP_FAILED) {
+        fprintf(stderr, "Can't map %s: %s\n", name, strerror(errno));
+        return 1;
+    }
+
+    if ((size_t) st.st_size < sizeof(ve_header_t)
+     || __atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != VE_MAGIC
+     || ring->version != VE_VERSION
+     || (size_t) st.st_size < ring->header_size + (size_t) ring->slots * ring->slot_size) {
+        fprintf(stderr, "%s is not a frame export ring\n", name);
+        return 1;
+    }
+
+    printf("%s: %ux%u %s, %u slots, written by pid %u\n", name, ring->width, ring->height,
+           ring->format == VE_FORMAT_RGB565 ? "RGB565" : "indexed", ring->slots,
+           ring->writer_pid);
+
+    snprintf(dump_tmp, sizeof(dump_tmp), "%s.tmp", dump ? dump : "");
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    last_print = now_ms();
+
+    while (running) {
+        uint32_t latest = __atomic_load_n(&ring->latest, __ATOMIC_ACQUIRE);
+        const ve_slot_t* slot;
+        uint32_t seq, sum;
+        int dumped = 0;
+
+        if (latest == last) {
+            sleep_ms(1);
+        } else {
+            slot = VE_SLOT(ring, latest);
+            seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+            // Odd or a different frame: already being reused
+            if ((seq & 1) || slot->frame != latest) {
+                stats.overwritten++;
+                last = latest;
+                continue;
+            }
+
+            // Use the frame in place
+            sum = checksum(VE_PIXELS(slot), (size_t) slot->pitch * slot->height);
+
+            if (dump != NULL) {
+                dumped = write_ppm(dump_tmp, slot);
+            }
+
+            if (slow > 0) {
+                sleep_ms(slow);
+            }
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+            if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+                stats.overwritten++;
+            } else {
+                if (last != 0 && latest - last > 1) {
+                    stats.missed += latest - last - 1;
+                }
+
+                stats.read++;
+
+                if (dumped) {
+                    rename(dump_tmp, dump);
+                }
+
+                if (slow > 0 || stats.read == 1) {
+                    printf("frame %u tic %d checksum %08x\n", latest, slot->tic, sum);
+                }
+            }
+
+            last = latest;
+        }
+
+        if (now_ms() - last_print >= 1000) {
+            printf("%u frames/s, %u missed, %u overwritten\n", stats.read - last_stats.read,
+                   stats.missed - last_stats.missed,
+                   stats.overwritten - last_stats.overwritten);
+            last_stats = stats;
+            last_print = now_ms();
+        }
+    }
+
+    if (dump != NULL) {
+        remove(dump_tmp);
+    }
+
+    printf("%u frames read, %u missed, %u overwritten while reading\n",
+           stats.read, stats.missed, stats.overwritten);
+
+    return 0;
+}
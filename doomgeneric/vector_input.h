@@ -0,0 +1,139 @@
+//
+// Input packets sent by remote-control/doomgeneric-vector-input.c to
+// the Vector build (doomgeneric_vector.c) over UDP, and what is sent
+// back: latency probe echoes and the frame stream.
+//
+// Version 1 is a bare 2 byte {pressed, key} datagram per key event and
+// is still accepted. Version 2 packets are a vi_header_t followed by
+// count vi_event_t, with a sequence number so the engine can spot lost
+// or reordered packets, and client timestamps in microseconds. All
+// fields are little-endian, which both ends are.
+//
+
+#ifndef VECTOR_INPUT_H
+#define VECTOR_INPUT_H
+
+#include <stdint.h>
+
+#define VI_PORT 666
+
+#define VI_MAGIC0 'D'
+#define VI_MAGIC1 'G'
+#define VI_VERSION 2
+
+#define VI_MAX_EVENTS 32
+#define VI_MAX_PACKET (sizeof(vi_header_t) + VI_MAX_EVENTS * sizeof(vi_event_t))
+
+// Event types
+
+enum
+{
+    VI_KEY_UP,
+    VI_KEY_DOWN,
+    VI_MOUSE,           // relative motion, becomes ev_mouse
+    VI_JOYSTICK,        // absolute axes, becomes ev_joystick
+    VI_STREAM,          // stream frames to the sender, see below
+};
+
+typedef struct
+{
+    uint8_t magic[2];
+    uint8_t version;
+    uint8_t count;      // events following the header
+    uint32_t seq;       // incremented for every packet, 0 on (re)start
+    uint32_t time_us;   // client clock when the packet was sent
+} vi_header_t;
+
+typedef struct
+{
+    uint32_t time_us;   // client clock when the event happened
+    uint8_t type;
+    uint8_t key;        // key events, same codes as version 1
+    int16_t x;          // mouse: turn delta, joystick: turn axis,
+                        // keys: latency probe id, 0 for none
+    int16_t y;          // mouse: forward delta, joystick: forward axis
+    int16_t z;          // joystick: strafe axis
+} vi_event_t;
+
+// Sent back to the client for every key event carrying a latency probe
+// id once the frame showing its effect has been written to the panel.
+// Stage times are engine microseconds since the packet was received.
+
+#define VI_LATENCY 0x80     // vi_latency_t type, where a header has count
+
+enum
+{
+    VI_STAGE_EVENT,     // handed to the engine by I_GetEvent
+    VI_STAGE_TICCMD,    // G_BuildTiccmd built the first ticcmd after it
+    VI_STAGE_DISPLAY,   // D_Display finished after that tic ran
+    VI_STAGE_PRESENT,   // that frame was written to the panel
+    VI_NUM_STAGES
+};
+
+typedef struct
+{
+    uint8_t magic[2];
+    uint8_t version;
+    uint8_t type;       // VI_LATENCY
+    uint32_t time_us;   // the event's client timestamp, echoed
+    uint16_t id;
+    uint16_t reserved;
+    int32_t tic;        // the tic the ticcmd was built for
+    uint32_t stage_us[VI_NUM_STAGES];
+} vi_latency_t;
+
+// Frame stream, sent when the engine runs with -stream to a client that
+// sends VI_STREAM events. Their x and y are the low and high halves of
+// the newest frame the client has complete, 0 if none.
+//
+// Frame numbers start again from 1 when the engine does, so each run
+// picks a new session and clients drop the frames they kept from an
+// earlier one when it changes.
+//
+// Key frames (ref == frame) are coded against nothing, delta frames
+// against an earlier frame ref that the client has acknowledged, so a
+// lost packet only costs the frame it was in. Clients should keep the
+// last VI_FRAME_HISTORY complete frames. A frame is split into packets
+// of at most VI_FRAME_PAYLOAD bytes after the header, each starting at
+// the pixel given by offset so that it decodes on its own. The first
+// packet of a key frame, or of a frame that changes the palette, has
+// VI_FRAME_PALETTE set and 256 RGB triplets before its ops.
+//
+// An op is a byte with the type in the top two bits and the length in
+// the low six. A length of 0 means a 16 bit length follows. Then:
+//   VI_OP_SKIP     nothing, the pixels are the same as in ref
+//   VI_OP_RUN      one pixel, repeated length times
+//   VI_OP_LITERAL  length pixels
+
+#define VI_FRAME 0x81       // vi_frame_t type, where a header has count
+
+#define VI_FRAME_PALETTE 1
+
+#define VI_FRAME_PAYLOAD 1200
+
+#define VI_FRAME_HISTORY 8
+
+#define VI_OP_SKIP 0x00
+#define VI_OP_RUN 0x40
+#define VI_OP_LITERAL 0x80
+#define VI_OP_TYPE 0xC0
+#define VI_OP_LENGTH 0x3F
+
+typedef struct
+{
+    uint8_t magic[2];
+    uint8_t version;
+    uint8_t type;       // VI_FRAME
+    uint32_t session;   // picked at engine start
+    uint32_t frame;
+    uint32_t ref;
+    uint16_t width;
+    uint16_t height;
+    uint16_t packet;    // index of this packet in the frame
+    uint16_t packets;
+    uint32_t offset;    // first pixel covered by this packet
+    uint16_t flags;
+    uint16_t size;      // bytes following the header
+} vi_frame_t;
+
+#endif
@@ -0,0 +1,450 @@
+//
+// Streams frames to the remote-control client.
+//
+// stream_submit only copies the frame. Coding and sending happen on
+// stream_thread, which like the LCD worker always takes the newest
+// frame. Frames are coded as runs and literals against the newest frame
+// the client has acknowledged, or as key frames if that is no longer in
+// stream_history. They are skipped while over the bandwidth budget.
+//
+// Frames are only submitted when the screen changes, so stream_ack
+// submits the screen again for a client that has nothing we can code
+// against, or that is still behind once the screen has been still for
+// STREAM_RESEND_MS.
+//
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "doomgeneric.h"
+#include "i_video.h"
+#include "vector_input.h"
+#include "vector_stream.h"
+
+#define STREAM_PIXELS (DOOMGENERIC_RESX * DOOMGENERIC_RESY)
+
+// Stop streaming to a client that hasn't acknowledged anything for this long
+#define STREAM_TIMEOUT_MS 2000
+
+// Resend a still screen to a client that missed it after this long
+#define STREAM_RESEND_MS 250
+
+// Enough for a key frame made only of literals
+#define STREAM_MAX_PACKETS (STREAM_PIXELS / (VI_FRAME_PAYLOAD - 768 - 3) + 2)
+
+static pthread_t stream_thread;
+static pthread_mutex_t stream_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stream_cond = PTHREAD_COND_INITIALIZER;
+
+static int stream_sock = -1;
+static int stream_kbps;
+static boolean stream_started = false;
+
+// Handed over to the worker, under stream_lock
+
+static uint8_t stream_next[STREAM_PIXELS];
+static uint8_t stream_next_palette[768];
+static boolean stream_next_new_palette = false;
+static boolean stream_pending = false;
+static boolean stream_has_client = false;
+static struct sockaddr_in stream_client;
+static uint32_t stream_acked = 0;
+static uint32_t stream_ack_time;
+static uint32_t stream_submit_time;
+static uint32_t stream_sent = 0;     // newest frame number sent
+
+// Worker state
+
+static uint8_t stream_frame[STREAM_PIXELS];
+static uint8_t stream_palette[768];
+static unsigned int stream_palette_serial = 0;
+static uint32_t stream_session;
+static uint32_t stream_frame_number = 0;
+static double stream_budget = 0;    // bytes we may still send
+static uint32_t stream_budget_time = 0;
+
+// The last frames sent, by frame number % VI_FRAME_HISTORY, and the
+// palette each was sent with
+
+typedef struct {
+    uint32_t frame;
+    unsigned int palette_serial;
+    uint8_t pixels[STREAM_PIXELS];
+} stream_sent_t;
+
+static stream_sent_t stream_history[VI_FRAME_HISTORY];
+
+typedef struct {
+    uint8_t data[sizeof(vi_frame_t) + VI_FRAME_PAYLOAD];
+    uint32_t offset;
+    int size;
+} stream_packet_t;
+
+static stream_packet_t stream_packets[STREAM_MAX_PACKETS];
+
+typedef struct {
+    unsigned int submitted;
+    unsigned int sent;
+    unsigned int key;
+    unsigned int skipped;
+    unsigned int packets;
+    unsigned long long bytes;
+} stream_stats_t;
+
+static stream_stats_t stream_stats;
+
+static uint32_t stream_time_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) ts.tv_sec * 1000u + ts.tv_nsec / 1000000;
+}
+
+// Append an op to the packet being filled, or return false if it
+// doesn't fit. For literals, *length is cut down to what does.
+
+static boolean stream_put_op(stream_packet_t* packet, int type, int* length,
+                             const uint8_t* pixels) {
+    uint8_t* out = packet->data + sizeof(vi_frame_t) + packet->size;
+    int space = VI_FRAME_PAYLOAD - packet->size;
+    int n = *length;
+    int header = n <= VI_OP_LENGTH ? 1 : 3;
+    int data = type == VI_OP_SKIP ? 0 : type == VI_OP_RUN ? 1 : n;
+
+    if (header + data > space) {
+        if (type != VI_OP_LITERAL || space < 2) {
+            return false;
+        }
+
+        n = space - 1 <= VI_OP_LENGTH ? space - 1 : space - 3;
+        header = n <= VI_OP_LENGTH ? 1 : 3;
+        data = n;
+    }
+
+    if (header == 1) {
+        *out++ = type | n;
+    } else {
+        *out++ = type;
+        *out++ = n & 0xFF;
+        *out++ = n >> 8;
+    }
+
+    memcpy(out, pixels, data);
+    packet->size += header + data;
+    *length = n;
+
+    return true;
+}
+
+// Code stream_frame into stream_packets, against ref unless that is
+// NULL for a key frame. Returns the number of packets, 0 if nothing
+// changed.
+
+static int stream_encode(const uint8_t* ref, boolean palette) {
+    const uint8_t* cur = stream_frame;
+    stream_packet_t* packet = &stream_packets[0];
+    boolean changed = ref == NULL || palette;
+    int packets = 1;
+    int i = 0;
+
+    packet->offset = 0;
+    packet->size = 0;
+
+    if (palette) {
+        memcpy(packet->data + sizeof(vi_frame_t), stream_palette, 768);
+        packet->size = 768;
+    }
+
+    while (i < STREAM_PIXELS) {
+        int type, length = 1;
+
+        if (ref != NULL && cur[i] == ref[i]) {
+            type = VI_OP_SKIP;
+            while (i + length < STREAM_PIXELS && length < 0xFFFF
+                && cur[i + length] == ref[i + length]) {
+                length++;
+            }
+        } else if (i + 2 < STREAM_PIXELS && cur[i] == cur[i + 1] && cur[i] == cur[i + 2]) {
+            type = VI_OP_RUN;
+            while (i + length < STREAM_PIXELS && length < 0xFFFF
+                && cur[i + length] == cur[i]) {
+                length++;
+            }
+        } else {
+            // Up to where a skip or run would be cheaper
+            type = VI_OP_LITERAL;
+            while (i + length + 3 < STREAM_PIXELS && length < 0xFFFF) {
+                int j = i + length;
+
+                if (ref != NULL && cur[j] == ref[j] && cur[j + 1] == ref[j + 1]) {
+                    break;
+                }
+
+                if (cur[j] == cur[j + 1] && cur[j] == cur[j + 2] && cur[j] == cur[j + 3]) {
+                    break;
+                }
+
+                length++;
+            }
+        }
+
+        // Nothing left to change
+        if (type == VI_OP_SKIP && i + length == STREAM_PIXELS) {
+            break;
+        }
+
+        if (!stream_put_op(packet, type, &length, cur + i)) {
+            packet = &stream_packets[packets++];
+            packet->offset = i;
+            packet->size = 0;
+            continue;
+        }
+
+        if (type != VI_OP_SKIP) {
+            changed = true;
+        }
+
+        i += length;
+    }
+
+    return changed ? packets : 0;
+}
+
+static void stream_send(int packets, uint32_t ref, boolean palette,
+                        const struct sockaddr_in* to) {
+    struct mmsghdr msgs[STREAM_MAX_PACKETS];
+    struct iovec iov[STREAM_MAX_PACKETS];
+    stream_sent_t* sent_frame;
+    vi_frame_t header;
+    int i, sent;
+
+    stream_frame_number++;
+
+    header.magic[0] = VI_MAGIC0;
+    header.magic[1] = VI_MAGIC1;
+    header.version = VI_VERSION;
+    header.type = VI_FRAME;
+    header.session = stream_session;
+    header.frame = stream_frame_number;
+    header.ref = ref != 0 ? ref : stream_frame_number;
+    header.width = DOOMGENERIC_RESX;
+    header.height = DOOMGENERIC_RESY;
+    header.packets = packets;
+
+    memset(msgs, 0, sizeof(msgs));
+
+    for (i = 0; i < packets; i++) {
+        header.packet = i;
+        header.offset = stream_packets[i].offset;
+        header.flags = i == 0 && palette ? VI_FRAME_PALETTE : 0;
+        header.size = stream_packets[i].size;
+        memcpy(stream_packets[i].data, &header, sizeof(header));
+
+        iov[i].iov_base = stream_packets[i].data;
+        iov[i].iov_len = sizeof(header) + stream_packets[i].size;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = (void*) to;
+        msgs[i].msg_hdr.msg_namelen = sizeof(*to);
+
+        stream_budget -= iov[i].iov_len;
+        stream_stats.bytes += iov[i].iov_len;
+    }
+
+    // Before the client can acknowledge it
+    pthread_mutex_lock(&stream_lock);
+    stream_sent = stream_frame_number;
+    pthread_mutex_unlock(&stream_lock);
+
+    for (i = 0; i < packets; i += sent) {
+        sent = sendmmsg(stream_sock, msgs + i, packets - i, 0);
+
+        if (sent <= 0) {
+            break;
+        }
+    }
+
+    stream_stats.sent++;
+    stream_stats.packets += packets;
+
+    if (ref == 0) {
+        stream_stats.key++;
+    }
+
+    sent_frame = &stream_history[stream_frame_number % VI_FRAME_HISTORY];
+    sent_frame->frame = stream_frame_number;
+    sent_frame->palette_serial = stream_palette_serial;
+    memcpy(sent_frame->pixels, stream_frame, STREAM_PIXELS);
+}
+
+static void* stream_thread_func(void* arg) {
+    struct sockaddr_in to;
+    stream_sent_t* ref;
+    uint32_t acked, now;
+    boolean palette;
+    int packets;
+
+    pthread_mutex_lock(&stream_lock);
+
+    for (;;) {
+        while (!stream_pending) {
+            pthread_cond_wait(&stream_cond, &stream_lock);
+        }
+
+        memcpy(stream_frame, stream_next, STREAM_PIXELS);
+
+        if (stream_next_new_palette) {
+            memcpy(stream_palette, stream_next_palette, 768);
+            stream_palette_serial++;
+            stream_next_new_palette = false;
+        }
+
+        acked = stream_acked;
+        stream_pending = false;
+        to = stream_client;
+
+        pthread_mutex_unlock(&stream_lock);
+
+        // Refill the budget, keeping at most a second's worth
+        now = stream_time_ms();
+        stream_budget += (double) (now - stream_budget_time) * stream_kbps / 8;
+        stream_budget_time = now;
+
+        if (stream_budget > stream_kbps * 1000.0 / 8) {
+            stream_budget = stream_kbps * 1000.0 / 8;
+        }
+
+        ref = &stream_history[acked % VI_FRAME_HISTORY];
+
+        if (acked == 0 || ref->frame != acked) {
+            ref = NULL;
+        }
+
+        if (stream_budget <= 0) {
+            stream_stats.skipped++;
+        } else {
+            palette = ref == NULL || ref->palette_serial != stream_palette_serial;
+            packets = stream_encode(ref != NULL ? ref->pixels : NULL, palette);
+
+            if (packets > 0) {
+                stream_send(packets, ref != NULL ? ref->frame : 0, palette, &to);
+            }
+        }
+
+        pthread_mutex_lock(&stream_lock);
+    }
+
+    return NULL;
+}
+
+void stream_init(int sock, int kbps) {
+    struct timespec ts;
+
+    // Tells a client still running from before a restart to start over
+    clock_gettime(CLOCK_REALTIME, &ts);
+    stream_session = (uint32_t) ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
+
+    stream_sock = sock;
+    stream_kbps = kbps;
+    stream_budget_time = stream_time_ms();
+
+    if (pthread_create(&stream_thread, NULL, stream_thread_func, NULL) != 0) {
+        fprintf(stderr, "Can't start stream thread\n");
+        return;
+    }
+
+    stream_started = true;
+
+    printf("Streaming frames to the remote client at up to %d kbit/s\n", kbps);
+}
+
+void stream_ack(const struct sockaddr_in* client, uint32_t acked) {
+    uint32_t now;
+    boolean resend;
+
+    if (!stream_started) {
+        return;
+    }
+
+    pthread_mutex_lock(&stream_lock);
+
+    now = stream_time_ms();
+
+    // Newer than anything we sent is a client left over from an earlier
+    // run, which is as good as a new one
+    if (acked > stream_sent) {
+        acked = 0;
+    }
+
+    // 0 is a new client, or one that lost track: start from a key frame
+    if (acked == 0 || acked > stream_acked) {
+        stream_acked = acked;
+    }
+
+    // Nothing to code against, or the newest frame went missing
+    resend = acked == 0 || stream_sent - acked >= VI_FRAME_HISTORY
+          || (acked != stream_sent && now - stream_submit_time > STREAM_RESEND_MS);
+
+    stream_client = *client;
+    stream_has_client = true;
+    stream_ack_time = now;
+
+    if (resend && !stream_pending) {
+        memcpy(stream_next, DG_ScreenBuffer, STREAM_PIXELS);
+        stream_pending = true;
+        stream_submit_time = now;
+        pthread_cond_signal(&stream_cond);
+    }
+
+    pthread_mutex_unlock(&stream_lock);
+}
+
+void stream_submit(boolean new_palette) {
+    int i;
+
+    if (!stream_started) {
+        return;
+    }
+
+    pthread_mutex_lock(&stream_lock);
+
+    if (new_palette) {
+        for (i = 0; i < 256; i++) {
+            stream_next_palette[i * 3] = colors[i].r;
+            stream_next_palette[i * 3 + 1] = colors[i].g;
+            stream_next_palette[i * 3 + 2] = colors[i].b;
+        }
+
+        stream_next_new_palette = true;
+    }
+
+    if (stream_has_client && stream_time_ms() - stream_ack_time > STREAM_TIMEOUT_MS) {
+        stream_has_client = false;
+    }
+
+    if (stream_has_client) {
+        memcpy(stream_next, DG_ScreenBuffer, STREAM_PIXELS);
+        stream_pending = true;
+        stream_submit_time = stream_time_ms();
+        stream_stats.submitted++;
+        pthread_cond_signal(&stream_cond);
+    }
+
+    pthread_mutex_unlock(&stream_lock);
+}
+
+void stream_print_stats(void) {
+    if (!stream_started) {
+        return;
+    }
+
+    // Racy against the worker, but only read for a summary
+    printf("Stream: %u frames sent (%u key) of %u, %u skipped for bandwidth, "
+           "%u packets, %llu KB\n",
+           stream_stats.sent, stream_stats.key, stream_stats.submitted,
+           stream_stats.skipped, stream_stats.packets, stream_stats.bytes / 1024);
+}
@@ -0,0 +1,26 @@
+//
+// Frame stream to the remote-control client (-stream), see
+// vector_input.h for the format.
+//
+
+#ifndef VECTOR_STREAM_H
+#define VECTOR_STREAM_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "doomtype.h"
+
+// Start the worker, sending from sock at no more than kbps
+void stream_init(int sock, int kbps);
+
+// Stream to client, which has frames up to acked complete (0 for none)
+void stream_ack(const struct sockaddr_in* client, uint32_t acked);
+
+// Hand over the frame in DG_ScreenBuffer. new_palette is set if colors
+// changed since the last call.
+void stream_submit(boolean new_palette);
+
+void stream_print_stats(void);
+
+#endif
@@ -20,6 +20,9 @@
 #include "z_zone.h"
 #include "i_system.h"
 #include "doomtype.h"
+#ifdef RENDER_THREADS
+#include "r_strips.h"
+#endif
 
 
 //
@@ -128,6 +131,12 @@ void Z_Free (void* ptr)
     memblock_t*		block;
     memblock_t*		other;
 	
+#ifdef RENDER_THREADS
+    // Render threads may still be drawing from the block, or reading
+    // past the end of a patch into the headers this rewrites.
+    R_FlushStrips ();
+#endif
+
     block = (memblock_t *) ( (byte *)ptr - sizeof(memblock_t));
 
     if (block->id != ZONEID)
@@ -194,6 +203,13 @@ Z_Malloc
     memblock_t*	base;
     void *result;
 
+#ifdef RENDER_THREADS
+    // Render threads may still be drawing from the blocks this purges,
+    // or, through columns that read past the end of their patch, from
+    // the free memory it writes a new block header into.
+    R_FlushStrips ();
+#endif
+
     size = (size + MEM_ALIGN - 1) & ~(MEM_ALIGN - 1);
     
     // scan through the block list,
@@ -440,6 +456,16 @@ void Z_ChangeTag2(void *ptr, int tag, char *file, int line)
         I_Error("%s:%i: Z_ChangeTag: an owner is required "
                 "for purgable blocks", file, line);
 
+    // Lumps are mostly cached again with the tag they already have
+    if (block->tag == tag)
+        return;
+
+#ifdef RENDER_THREADS
+    // Render threads may be reading past the end of a patch into
+    // the header this writes.
+    R_FlushStrips ();
+#endif
+
     block->tag = tag;
 }
 
@@ -454,6 +480,10 @@ void Z_ChangeUser(void *ptr, void **user)
         I_Error("Z_ChangeUser: Tried to change user for invalid block!");
     }
 
+#ifdef RENDER_THREADS
+    R_FlushStrips ();
+#endif
+
     block->user = user;
     *user = ptr;
 }
@@ -1,13 +1,20 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <time.h>
 #include <SDL2/SDL.h>
 
-#define SERVER_PORT 666
+#include "../doomgeneric/vector_input.h"
+
+#define SERVER_PORT VI_PORT
+
+// Stick positions closer to the centre than this count as centred
+#define STICK_DEADZONE 8000
 
 unsigned char sdl_to_doom(SDL_Keycode key) {
     switch (key) {
@@ -30,13 +37,430 @@ unsigned char sdl_to_doom(SDL_Keycode key) {
     }
 }
 
+static uint32_t time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
+}
+
+// Version 2 packet being built. Everything that happened in one pass
+// over the SDL event queue goes out in a single datagram.
+
+static unsigned char packet[VI_MAX_PACKET];
+static int packet_events = 0;
+static uint32_t packet_seq = 0;
+
+static int mouse_x = 0, mouse_y = 0;
+static int16_t stick[3];
+static int stick_changed = 0;
+
+static void flush_packet(int sock) {
+    vi_header_t header;
+
+    if (packet_events == 0) {
+        return;
+    }
+
+    header.magic[0] = VI_MAGIC0;
+    header.magic[1] = VI_MAGIC1;
+    header.version = VI_VERSION;
+    header.count = packet_events;
+    header.seq = packet_seq++;
+    header.time_us = time_us();
+    memcpy(packet, &header, sizeof(header));
+
+    send(sock, packet, sizeof(header) + packet_events * sizeof(vi_event_t), 0);
+    packet_events = 0;
+}
+
+static void add_event(int sock, uint8_t type, uint8_t key, int x, int y, int z) {
+    vi_event_t ev;
+
+    if (packet_events == VI_MAX_EVENTS) {
+        flush_packet(sock);
+    }
+
+    ev.time_us = time_us();
+    ev.type = type;
+    ev.key = key;
+    ev.x = x;
+    ev.y = y;
+    ev.z = z;
+    memcpy(packet + sizeof(vi_header_t) + packet_events * sizeof(ev), &ev, sizeof(ev));
+    packet_events++;
+}
+
+static int16_t clamp16(int value) {
+    if (value < INT16_MIN) return INT16_MIN;
+    if (value > INT16_MAX) return INT16_MAX;
+    return value;
+}
+
+static int16_t stick_axis(int value) {
+    if (value > -STICK_DEADZONE && value < STICK_DEADZONE) return 0;
+    return value;
+}
+
+// -latency: every key event carries a probe id, the engine echoes back
+// when it reached each stage and we keep the time spent in each.
+
+enum {
+    LAT_QUEUE,      // received -> read by I_GetEvent
+    LAT_TIC,        // -> G_BuildTiccmd
+    LAT_RENDER,     // -> D_Display done, after the tic ran
+    LAT_PANEL,      // -> written to the LCD
+    LAT_NETWORK,    // both ways, and time spent in this client
+    LAT_TOTAL,
+    LAT_STAGES
+};
+
+static const char *lat_names[LAT_STAGES] = {
+    "socket -> I_GetEvent",
+    "I_GetEvent -> ticcmd",
+    "ticcmd -> D_Display",
+    "D_Display -> panel",
+    "network",
+    "total",
+};
+
+static int latency = 0;
+static uint16_t probe_id = 0;
+static uint32_t *lat_samples[LAT_STAGES];
+static int lat_count = 0, lat_alloc = 0;
+
+static uint16_t next_probe(void) {
+    if (!latency) return 0;
+    if (++probe_id == 0) probe_id = 1;
+    return probe_id;
+}
+
+static void add_latency(const vi_latency_t *echo) {
+    if (lat_count == lat_alloc) {
+        lat_alloc = lat_alloc ? lat_alloc * 2 : 256;
+        for (int i = 0; i < LAT_STAGES; i++) {
+            lat_samples[i] = realloc(lat_samples[i], lat_alloc * sizeof(uint32_t));
+        }
+    }
+
+    const uint32_t *stage = echo->stage_us;
+    uint32_t total = time_us() - echo->time_us;
+
+    lat_samples[LAT_QUEUE][lat_count] = stage[VI_STAGE_EVENT];
+    lat_samples[LAT_TIC][lat_count] = stage[VI_STAGE_TICCMD] - stage[VI_STAGE_EVENT];
+    lat_samples[LAT_RENDER][lat_count] = stage[VI_STAGE_DISPLAY] - stage[VI_STAGE_TICCMD];
+    lat_samples[LAT_PANEL][lat_count] = stage[VI_STAGE_PRESENT] - stage[VI_STAGE_DISPLAY];
+    lat_samples[LAT_NETWORK][lat_count] = total - stage[VI_STAGE_PRESENT];
+    lat_samples[LAT_TOTAL][lat_count] = total;
+    lat_count++;
+}
+
+// -stream: the engine sends its frames back, coded against a frame we
+// acknowledged (see vector_input.h). We keep the last VI_FRAME_HISTORY
+// complete ones and show the newest.
+
+#define STREAM_ACK_MS 500
+
+typedef struct {
+    uint32_t frame;         // 0 for an empty slot
+    int width, height;
+    uint8_t *pixels;
+    uint8_t palette[768];
+} stream_frame_t;
+
+static int streaming = 0;
+static stream_frame_t stream_frames[VI_FRAME_HISTORY];
+static stream_frame_t stream_work;          // frame being put together
+static uint8_t stream_got[65536];           // packets of it received
+static int stream_got_count, stream_packets;
+static uint32_t stream_session = 0;       // the engine run frames are from
+static uint32_t stream_newest = 0;
+static uint32_t stream_lost = 0;            // frame we couldn't decode
+static int stream_shown = 1;
+static uint32_t stream_ack_time = 0;
+static unsigned int stream_complete = 0, stream_dropped = 0;
+
+static void stream_ack(int sock, uint32_t frame) {
+    add_event(sock, VI_STREAM, 0, (int16_t)(frame & 0xFFFF), (int16_t)(frame >> 16), 0);
+    stream_ack_time = time_us();
+}
+
+// The engine restarted: its frame numbers start again, and nothing we
+// kept can be a reference
+
+static void stream_reset(uint32_t session) {
+    for (int i = 0; i < VI_FRAME_HISTORY; i++) {
+        stream_frames[i].frame = 0;
+    }
+
+    stream_work.frame = 0;
+    stream_newest = 0;
+    stream_lost = 0;
+    stream_session = session;
+}
+
+static stream_frame_t *stream_find(uint32_t frame) {
+    stream_frame_t *f = &stream_frames[frame % VI_FRAME_HISTORY];
+    return f->frame == frame ? f : NULL;
+}
+
+// Start putting together frame from header, on top of its reference.
+// Returns 0 if we don't have that any more.
+
+static int stream_start(const vi_frame_t *header) {
+    size_t size = (size_t)header->width * header->height;
+    const stream_frame_t *ref = NULL;
+
+    if (header->ref != header->frame) {
+        ref = stream_find(header->ref);
+        if (ref == NULL || ref->width != header->width || ref->height != header->height) {
+            return 0;
+        }
+    }
+
+    if (stream_work.frame != 0 && stream_got_count < stream_packets) {
+        stream_dropped++;
+    }
+
+    if ((size_t)stream_work.width * stream_work.height != size) {
+        stream_work.pixels = realloc(stream_work.pixels, size);
+    }
+
+    stream_work.frame = header->frame;
+    stream_work.width = header->width;
+    stream_work.height = header->height;
+
+    if (ref != NULL) {
+        memcpy(stream_work.pixels, ref->pixels, size);
+        memcpy(stream_work.palette, ref->palette, sizeof(ref->palette));
+    } else {
+        memset(stream_work.pixels, 0, size);
+    }
+
+    memset(stream_got, 0, sizeof(stream_got));
+    stream_got_count = 0;
+    stream_packets = header->packets;
+
+    return 1;
+}
+
+// Apply one packet's ops to stream_work. Returns 0 if it is malformed.
+
+static int stream_decode(const vi_frame_t *header, const uint8_t *data) {
+    const uint8_t *end = data + header->size;
+    uint8_t *pixels = stream_work.pixels;
+    uint32_t size = (uint32_t)stream_work.width * stream_work.height;
+    uint32_t i = header->offset;
+
+    if (header->flags & VI_FRAME_PALETTE) {
+        if (header->size < 768) return 0;
+        memcpy(stream_work.palette, data, 768);
+        data += 768;
+    }
+
+    while (data < end) {
+        int type = *data & VI_OP_TYPE;
+        uint32_t length = *data++ & VI_OP_LENGTH;
+
+        if (length == 0) {
+            if (end - data < 2) return 0;
+            length = data[0] | data[1] << 8;
+            data += 2;
+        }
+
+        if (i + length > size) return 0;
+
+        if (type == VI_OP_RUN) {
+            if (data == end) return 0;
+            memset(pixels + i, *data++, length);
+        } else if (type == VI_OP_LITERAL) {
+            if ((uint32_t)(end - data) < length) return 0;
+            memcpy(pixels + i, data, length);
+            data += length;
+        } else if (type != VI_OP_SKIP) {
+            return 0;
+        }
+
+        i += length;
+    }
+
+    return 1;
+}
+
+static void stream_receive(int sock, const uint8_t *buf, ssize_t len) {
+    vi_frame_t header;
+
+    if (len < (ssize_t)sizeof(header)) return;
+    memcpy(&header, buf, sizeof(header));
+
+    if (header.size > len - sizeof(header) || header.packet >= header.packets
+     || header.width == 0 || header.height == 0) {
+        return;
+    }
+
+    if (header.session != stream_session) stream_reset(header.session);
+
+    // Older than what we are on, the rest of it is never coming
+    if (header.frame <= stream_newest
+     || (stream_work.frame != 0 && header.frame < stream_work.frame)) {
+        return;
+    }
+
+    if (header.frame == stream_lost) return;
+
+    if (header.frame != stream_work.frame && !stream_start(&header)) {
+        // Lost track of the reference: ask for a key frame
+        stream_lost = header.frame;
+        stream_ack(sock, 0);
+        return;
+    }
+
+    if (stream_got[header.packet] || !stream_decode(&header, buf + sizeof(header))) {
+        return;
+    }
+
+    stream_got[header.packet] = 1;
+
+    if (++stream_got_count < stream_packets) return;
+
+    // Complete: swap it into the history, keeping the old buffer to reuse
+    stream_frame_t *slot = &stream_frames[stream_work.frame % VI_FRAME_HISTORY];
+    stream_frame_t old = *slot;
+
+    *slot = stream_work;
+    stream_work = old;
+    stream_work.frame = 0;
+
+    stream_newest = slot->frame;
+    stream_shown = 0;
+    stream_complete++;
+    stream_ack(sock, stream_newest);
+}
+
+static void receive_packets(int sock) {
+    static uint8_t buf[sizeof(vi_frame_t) + VI_FRAME_PAYLOAD];
+    ssize_t len;
+
+    while ((len = recv(sock, buf, sizeof(buf), MSG_DONTWAIT)) >= 4) {
+        if (buf[0] != VI_MAGIC0 || buf[1] != VI_MAGIC1) {
+            continue;
+        }
+
+        if (buf[3] == VI_LATENCY && len == sizeof(vi_latency_t) && latency) {
+            vi_latency_t echo;
+            memcpy(&echo, buf, sizeof(echo));
+            add_latency(&echo);
+        } else if (buf[3] == VI_FRAME && streaming) {
+            stream_receive(sock, buf, len);
+        }
+    }
+
+    // Keep the engine streaming while the picture doesn't change
+    if (streaming && time_us() - stream_ack_time > STREAM_ACK_MS * 1000) {
+        stream_ack(sock, stream_newest);
+    }
+}
+
+// Show the newest complete frame, letterboxed to 4:3
+
+static void stream_draw(SDL_Renderer *renderer, SDL_Texture **texture) {
+    static int tex_width, tex_height;
+    const stream_frame_t *f = stream_find(stream_newest);
+
+    if (stream_newest == 0 || f == NULL) return;
+
+    if (*texture == NULL || tex_width != f->width || tex_height != f->height) {
+        if (*texture) SDL_DestroyTexture(*texture);
+        *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                     SDL_TEXTUREACCESS_STREAMING, f->width, f->height);
+        if (*texture == NULL) return;
+        tex_width = f->width;
+        tex_height = f->height;
+        stream_shown = 0;
+    }
+
+    if (!stream_shown) {
+        void *out;
+        int pitch;
+
+        if (SDL_LockTexture(*texture, NULL, &out, &pitch) == 0) {
+            uint32_t argb[256];
+
+            for (int i = 0; i < 256; i++) {
+                const uint8_t *c = f->palette + i * 3;
+                argb[i] = 0xFF000000u | c[0] << 16 | c[1] << 8 | c[2];
+            }
+
+            for (int y = 0; y < f->height; y++) {
+                uint32_t *row = (uint32_t *)((uint8_t *)out + y * pitch);
+                const uint8_t *src = f->pixels + y * f->width;
+                for (int x = 0; x < f->width; x++) {
+                    row[x] = argb[src[x]];
+                }
+            }
+
+            SDL_UnlockTexture(*texture);
+        }
+
+        stream_shown = 1;
+    }
+
+    int w, h;
+    SDL_GetRendererOutputSize(renderer, &w, &h);
+
+    SDL_Rect dst = { 0, 0, w, w * 3 / 4 };
+    if (dst.h > h) {
+        dst.h = h;
+        dst.w = h * 4 / 3;
+    }
+    dst.x = (w - dst.w) / 2;
+    dst.y = (h - dst.h) / 2;
+
+    SDL_RenderCopy(renderer, *texture, NULL, &dst);
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_latency(void) {
+    if (lat_count == 0) return;
+
+    printf("Latency over %d key events, ms:\n", lat_count);
+    printf("  %-22s %7s %7s %7s %7s\n", "", "p50", "p90", "p99", "max");
+
+    for (int i = 0; i < LAT_STAGES; i++) {
+        uint32_t *v = lat_samples[i];
+        qsort(v, lat_count, sizeof(uint32_t), compare_u32);
+        printf("  %-22s %7.1f %7.1f %7.1f %7.1f\n", lat_names[i],
+               v[lat_count * 50 / 100] / 1000.0, v[lat_count * 90 / 100] / 1000.0,
+               v[lat_count * 99 / 100] / 1000.0, v[lat_count - 1] / 1000.0);
+    }
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <server_ip>\n", argv[0]);
+    const char *server = NULL;
+    int legacy = 0;
+    int grab_mouse = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-v1")) legacy = 1;
+        else if (!strcmp(argv[i], "-mouse")) grab_mouse = 1;
+        else if (!strcmp(argv[i], "-latency")) latency = 1;
+        else if (!strcmp(argv[i], "-stream")) streaming = 1;
+        else server = argv[i];
+    }
+
+    if (server == NULL) {
+        fprintf(stderr, "Usage: %s [-v1] [-mouse] [-latency] [-stream] <server_ip>\n", argv[0]);
+        fprintf(stderr, "  -v1       send one 2 byte packet per key, for older builds\n");
+        fprintf(stderr, "  -mouse    capture the mouse to turn and move\n");
+        fprintf(stderr, "  -latency  time each key until it is on the LCD, printed on exit\n");
+        fprintf(stderr, "  -stream   show the game, if the engine was started with -stream\n");
         return 1;
     }
 
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_GAMECONTROLLER) < 0) {
         fprintf(stderr, "SDL_Init failed: %s\n", SDL_GetError());
         return 1;
     }
@@ -46,7 +470,7 @@ int main(int argc, char *argv[]) {
         SDL_WINDOWPOS_CENTERED,
         SDL_WINDOWPOS_CENTERED,
         600, 550,
-        SDL_WINDOW_SHOWN
+        SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE
     );
 
     if (!win) {
@@ -63,6 +487,8 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    SDL_Texture *texture = NULL;
+
     printf("Connecting...\n");
 
     int sock = socket(AF_INET, SOCK_DGRAM, 0);
@@ -76,8 +502,8 @@ int main(int argc, char *argv[]) {
     addr.sin_family = AF_INET;
     addr.sin_port = htons(SERVER_PORT);
 
-    if (inet_pton(AF_INET, argv[1], &addr.sin_addr) != 1) {
-        fprintf(stderr, "Invalid IP address: %s\n", argv[1]);
+    if (inet_pton(AF_INET, server, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid IP address: %s\n", server);
         goto cleanup;
     }
 
@@ -110,6 +536,21 @@ int main(int argc, char *argv[]) {
 
     printf("Connected!\n");
 
+    if (grab_mouse && !legacy) {
+        SDL_SetRelativeMouseMode(SDL_TRUE);
+    }
+
+    if (legacy) {
+        streaming = 0;
+    }
+
+    if (streaming) {
+        // Room for a few key frames arriving at once
+        int rcvbuf = 1 << 20;
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        stream_ack(sock, 0);
+    }
+
     SDL_Event e;
     int running = 1;
     while (running) {
@@ -122,23 +563,82 @@ int main(int argc, char *argv[]) {
                 if (key) {
 		    //printf("%c\n", key);
 
-                    unsigned char packet[2] = {
-                        e.type == SDL_KEYDOWN ? 1 : 0,
-                        key
-                    };
-                    send(sock, packet, 2, 0);
+                    if (legacy) {
+                        unsigned char packet[2] = {
+                            e.type == SDL_KEYDOWN ? 1 : 0,
+                            key
+                        };
+                        send(sock, packet, 2, 0);
+                    } else {
+                        add_event(sock, e.type == SDL_KEYDOWN ? VI_KEY_DOWN : VI_KEY_UP,
+                                  key, next_probe(), 0, 0);
+                    }
                 }
             }
+
+            if (e.type == SDL_MOUSEMOTION && grab_mouse) {
+                mouse_x += e.motion.xrel;
+                mouse_y -= e.motion.yrel;
+            }
+
+            if (e.type == SDL_CONTROLLERDEVICEADDED) {
+                SDL_GameControllerOpen(e.cdevice.which);
+            }
+
+            // Right stick turns, left stick moves and strafes
+            if (e.type == SDL_CONTROLLERAXISMOTION) {
+                int axis = -1;
+
+                switch (e.caxis.axis) {
+                    case SDL_CONTROLLER_AXIS_RIGHTX: axis = 0; break;
+                    case SDL_CONTROLLER_AXIS_LEFTY: axis = 1; break;
+                    case SDL_CONTROLLER_AXIS_LEFTX: axis = 2; break;
+                }
+
+                if (axis >= 0 && stick[axis] != stick_axis(e.caxis.value)) {
+                    stick[axis] = stick_axis(e.caxis.value);
+                    stick_changed = 1;
+                }
+            }
+        }
+
+        if (!legacy) {
+            if (mouse_x != 0 || mouse_y != 0) {
+                add_event(sock, VI_MOUSE, 0,
+                          clamp16(mouse_x), clamp16(mouse_y), 0);
+                mouse_x = mouse_y = 0;
+            }
+
+            if (stick_changed) {
+                add_event(sock, VI_JOYSTICK, 0, stick[0], stick[1], stick[2]);
+                stick_changed = 0;
+            }
+
+            if (latency || streaming) {
+                receive_packets(sock);
+            }
+
+            flush_packet(sock);
         }
 
         SDL_SetRenderDrawColor(renderer, 40, 40, 40, 255);
         SDL_RenderClear(renderer);
+        if (streaming) {
+            stream_draw(renderer, &texture);
+        }
         SDL_RenderPresent(renderer);
         SDL_Delay(1);
     }
 
+    print_latency();
+
+    if (streaming) {
+        printf("Stream: %u frames complete, %u lost\n", stream_complete, stream_dropped);
+    }
+
 cleanup:
     if (sock >= 0) close(sock);
+    if (texture) SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(win);
     SDL_Quit();